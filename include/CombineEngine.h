@@ -23,13 +23,31 @@
 #include <map>
 #include <unordered_map>
 #include <functional>
-#include <typeindex>
+#include <typeinfo>
 #include <chrono>
 #include <algorithm>
 #include <cmath>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <cstdint>
+#include <stdexcept>
+#include <new>
+#include <mutex>
+#include <tuple>
+#include <bitset>
+#include <array>
+#include <atomic>
+#include <utility>
+#include <limits>
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define COMBINE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+#include "JobSystem.h"
 
 namespace Combine {
 
@@ -59,6 +77,8 @@ struct Vector3 {
         return Vector3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
     }
     static float dot(const Vector3& a, const Vector3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    bool operator==(const Vector3& other) const { return x == other.x && y == other.y && z == other.z; }
+    bool operator!=(const Vector3& other) const { return !(*this == other); }
 };
 
 struct Vector4 {
@@ -66,6 +86,257 @@ struct Vector4 {
     Vector4(float x = 0, float y = 0, float z = 0, float w = 1) : x(x), y(y), z(z), w(w) {}
 };
 
+// Column-major, matching what OpenGL expects for glUniformMatrix4fv.
+struct Matrix4 {
+    float m[16];
+
+    Matrix4() { *this = identity(); }
+
+    static Matrix4 identity() {
+        Matrix4 r(0.0f);
+        r.m[0] = r.m[5] = r.m[10] = r.m[15] = 1.0f;
+        return r;
+    }
+
+    static Matrix4 translation(const Vector3& t) {
+        Matrix4 r;
+        r.m[12] = t.x; r.m[13] = t.y; r.m[14] = t.z;
+        return r;
+    }
+
+    static Matrix4 scaling(const Vector3& s) {
+        Matrix4 r;
+        r.m[0] = s.x; r.m[5] = s.y; r.m[10] = s.z;
+        return r;
+    }
+
+    // Euler angles in degrees, applied X then Y then Z like the renderer always has.
+    static Matrix4 rotation(const Vector3& degrees) {
+        const float toRad = 3.14159265358979323846f / 180.0f;
+        float cx = std::cos(degrees.x * toRad), sx = std::sin(degrees.x * toRad);
+        float cy = std::cos(degrees.y * toRad), sy = std::sin(degrees.y * toRad);
+        float cz = std::cos(degrees.z * toRad), sz = std::sin(degrees.z * toRad);
+        Matrix4 r;
+        r.m[0] = cy * cz;
+        r.m[1] = sx * sy * cz + cx * sz;
+        r.m[2] = -cx * sy * cz + sx * sz;
+        r.m[4] = -cy * sz;
+        r.m[5] = -sx * sy * sz + cx * cz;
+        r.m[6] = cx * sy * sz + sx * cz;
+        r.m[8] = sy;
+        r.m[9] = -sx * cy;
+        r.m[10] = cx * cy;
+        return r;
+    }
+
+    // translation * rotation * scale
+    static Matrix4 compose(const Vector3& position, const Vector3& rotationDegrees, const Vector3& scale) {
+        Matrix4 r = rotation(rotationDegrees);
+        for (int i = 0; i < 3; i++) {
+            r.m[i] *= scale.x;
+            r.m[4 + i] *= scale.y;
+            r.m[8 + i] *= scale.z;
+        }
+        r.m[12] = position.x; r.m[13] = position.y; r.m[14] = position.z;
+        return r;
+    }
+
+    Matrix4 operator*(const Matrix4& b) const {
+        Matrix4 r(0.0f);
+        for (int c = 0; c < 4; c++) {
+            for (int row = 0; row < 4; row++) {
+                float sum = 0.0f;
+                for (int k = 0; k < 4; k++) {
+                    sum += m[k * 4 + row] * b.m[c * 4 + k];
+                }
+                r.m[c * 4 + row] = sum;
+            }
+        }
+        return r;
+    }
+
+    Vector3 transformPoint(const Vector3& p) const {
+        return Vector3(m[0] * p.x + m[4] * p.y + m[8] * p.z + m[12],
+                       m[1] * p.x + m[5] * p.y + m[9] * p.z + m[13],
+                       m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14]);
+    }
+
+    Vector3 transformDirection(const Vector3& d) const {
+        return Vector3(m[0] * d.x + m[4] * d.y + m[8] * d.z,
+                       m[1] * d.x + m[5] * d.y + m[9] * d.z,
+                       m[2] * d.x + m[6] * d.y + m[10] * d.z);
+    }
+
+    // Multiplies by the transposed upper 3x3. For a rotation that undoes it;
+    // on an inverse world matrix it takes local normals to world space.
+    Vector3 transformTransposed(const Vector3& d) const {
+        return Vector3(m[0] * d.x + m[1] * d.y + m[2] * d.z,
+                       m[4] * d.x + m[5] * d.y + m[6] * d.z,
+                       m[8] * d.x + m[9] * d.y + m[10] * d.z);
+    }
+
+    Vector3 getTranslation() const { return Vector3(m[12], m[13], m[14]); }
+
+    // Inverse of a matrix whose bottom row is (0, 0, 0, 1), which every
+    // transform matrix is. A singular matrix gives all zeros.
+    Matrix4 affineInverse() const {
+        float a = m[0], b = m[4], c = m[8];
+        float d = m[1], e = m[5], f = m[9];
+        float g = m[2], h = m[6], i = m[10];
+        float c0 = e * i - f * h, c1 = f * g - d * i, c2 = d * h - e * g;
+        float det = a * c0 + b * c1 + c * c2;
+        if (det == 0.0f) return Matrix4(0.0f);
+        float s = 1.0f / det;
+        Matrix4 r;
+        r.m[0] = c0 * s;              r.m[4] = (c * h - b * i) * s; r.m[8] = (b * f - c * e) * s;
+        r.m[1] = c1 * s;              r.m[5] = (a * i - c * g) * s; r.m[9] = (c * d - a * f) * s;
+        r.m[2] = c2 * s;              r.m[6] = (b * g - a * h) * s; r.m[10] = (a * e - b * d) * s;
+        Vector3 t = r.transformDirection(getTranslation());
+        r.m[12] = -t.x; r.m[13] = -t.y; r.m[14] = -t.z;
+        return r;
+    }
+
+    // OpenGL-style clip space, same as glm::perspective.
+    static Matrix4 perspective(float fovDegrees, float aspect, float nearPlane, float farPlane) {
+        float f = 1.0f / std::tan(fovDegrees * 3.14159265358979323846f / 360.0f);
+        Matrix4 r(0.0f);
+        r.m[0] = f / aspect;
+        r.m[5] = f;
+        r.m[10] = -(farPlane + nearPlane) / (farPlane - nearPlane);
+        r.m[11] = -1.0f;
+        r.m[14] = -(2.0f * farPlane * nearPlane) / (farPlane - nearPlane);
+        return r;
+    }
+
+    const float* data() const { return m; }
+
+private:
+    explicit Matrix4(float fill) { std::fill(m, m + 16, fill); }
+};
+
+struct BoundingSphere {
+    Vector3 center;
+    float radius = 0.0f;
+};
+
+// Axis-aligned box. A default-constructed box is empty and grows with expand().
+struct BoundingBox {
+    Vector3 min;
+    Vector3 max;
+
+    BoundingBox()
+        : min(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()),
+          max(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()) {}
+    BoundingBox(const Vector3& min, const Vector3& max) : min(min), max(max) {}
+
+    bool empty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+    Vector3 center() const { return (min + max) * 0.5f; }
+    Vector3 extents() const { return (max - min) * 0.5f; }
+
+    void expand(const Vector3& p) {
+        min = Vector3(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+        max = Vector3(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+    }
+
+    void expand(const BoundingBox& other) {
+        if (other.empty()) return;
+        expand(other.min);
+        expand(other.max);
+    }
+
+    bool intersects(const BoundingBox& other) const {
+        return min.x <= other.max.x && max.x >= other.min.x &&
+               min.y <= other.max.y && max.y >= other.min.y &&
+               min.z <= other.max.z && max.z >= other.min.z;
+    }
+
+    bool contains(const Vector3& p) const {
+        return p.x >= min.x && p.x <= max.x && p.y >= min.y && p.y <= max.y && p.z >= min.z && p.z <= max.z;
+    }
+
+    // Box enclosing this one after transformation: the centre is transformed
+    // and the extents are projected onto the absolute basis vectors.
+    BoundingBox transformed(const Matrix4& matrix) const {
+        if (empty()) return *this;
+        const float* m = matrix.m;
+        Vector3 c = matrix.transformPoint(center());
+        Vector3 e = extents();
+        Vector3 r(std::fabs(m[0]) * e.x + std::fabs(m[4]) * e.y + std::fabs(m[8]) * e.z,
+                  std::fabs(m[1]) * e.x + std::fabs(m[5]) * e.y + std::fabs(m[9]) * e.z,
+                  std::fabs(m[2]) * e.x + std::fabs(m[6]) * e.y + std::fabs(m[10]) * e.z);
+        return BoundingBox(c - r, c + r);
+    }
+};
+
+// Frustum planes (inward normal, distance) pulled from a view-projection
+// matrix. They are kept as four-wide columns, padded to eight with planes
+// every point passes, so a box is tested against four planes per SSE step.
+struct Frustum {
+    alignas(16) float nx[8];
+    alignas(16) float ny[8];
+    alignas(16) float nz[8];
+    alignas(16) float d[8];
+
+    static Frustum fromMatrix(const Matrix4& viewProjection) {
+        const float* m = viewProjection.m;
+        auto row = [m](int i) { return Vector4(m[i], m[4 + i], m[8 + i], m[12 + i]); };
+        Vector4 r0 = row(0), r1 = row(1), r2 = row(2), r3 = row(3);
+        Vector4 planes[6] = {
+            Vector4(r3.x + r0.x, r3.y + r0.y, r3.z + r0.z, r3.w + r0.w),
+            Vector4(r3.x - r0.x, r3.y - r0.y, r3.z - r0.z, r3.w - r0.w),
+            Vector4(r3.x + r1.x, r3.y + r1.y, r3.z + r1.z, r3.w + r1.w),
+            Vector4(r3.x - r1.x, r3.y - r1.y, r3.z - r1.z, r3.w - r1.w),
+            Vector4(r3.x + r2.x, r3.y + r2.y, r3.z + r2.z, r3.w + r2.w),
+            Vector4(r3.x - r2.x, r3.y - r2.y, r3.z - r2.z, r3.w - r2.w)
+        };
+        Frustum f;
+        for (int i = 0; i < 8; i++) {
+            Vector4 p = i < 6 ? planes[i] : Vector4(0, 0, 0, 1);
+            float length = i < 6 ? std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z) : 1.0f;
+            f.nx[i] = p.x / length;
+            f.ny[i] = p.y / length;
+            f.nz[i] = p.z / length;
+            f.d[i] = p.w / length;
+        }
+        return f;
+    }
+
+    bool intersects(const BoundingBox& box) const {
+        if (box.empty()) return false;
+        Vector3 c = box.center();
+        Vector3 e = box.extents();
+#ifdef COMBINE_SSE
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        __m128 cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), cz = _mm_set1_ps(c.z);
+        __m128 ex = _mm_set1_ps(e.x), ey = _mm_set1_ps(e.y), ez = _mm_set1_ps(e.z);
+        for (int i = 0; i < 8; i += 4) {
+            __m128 px = _mm_load_ps(nx + i), py = _mm_load_ps(ny + i), pz = _mm_load_ps(nz + i);
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)),
+                                     _mm_add_ps(_mm_mul_ps(pz, cz), _mm_load_ps(d + i)));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, px), ex),
+                                                  _mm_mul_ps(_mm_andnot_ps(signMask, py), ey)),
+                                       _mm_mul_ps(_mm_andnot_ps(signMask, pz), ez));
+            if (_mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, radius), _mm_setzero_ps()))) return false;
+        }
+        return true;
+#else
+        for (int i = 0; i < 6; i++) {
+            float dist = nx[i] * c.x + ny[i] * c.y + nz[i] * c.z + d[i];
+            float radius = std::fabs(nx[i]) * e.x + std::fabs(ny[i]) * e.y + std::fabs(nz[i]) * e.z;
+            if (dist + radius < 0.0f) return false;
+        }
+        return true;
+#endif
+    }
+
+    bool intersects(const BoundingSphere& sphere) const {
+        for (int i = 0; i < 6; i++) {
+            if (nx[i] * sphere.center.x + ny[i] * sphere.center.y + nz[i] * sphere.center.z + d[i] < -sphere.radius) return false;
+        }
+        return true;
+    }
+};
+
 struct Color {
     float r, g, b, a;
     Color(float r = 1, float g = 1, float b = 1, float a = 1) : r(r), g(g), b(b), a(a) {}
@@ -79,14 +350,90 @@ struct Color {
     static Color magenta() { return Color(1, 0, 1, 1); }
 };
 
+// position/rotation/scale stay public so scripts can poke at them directly;
+// the cached matrices notice such writes by comparing against the values they
+// were last built from. World matrices are refreshed by Scene::updateTransforms.
 struct Transform {
     Vector3 position;
     Vector3 rotation;
     Vector3 scale;
     Transform() : scale(1, 1, 1) {}
+    Transform(const Transform& other) : position(other.position), rotation(other.rotation), scale(other.scale) {}
+    Transform& operator=(const Transform& other) {
+        position = other.position;
+        rotation = other.rotation;
+        scale = other.scale;
+        dirty = true;
+        return *this;
+    }
+    ~Transform() {
+        setParent(nullptr);
+        for (Transform* child : children) {
+            child->parent = nullptr;
+            child->dirty = true;
+        }
+    }
+    
+    void translate(const Vector3& delta) { position += delta; dirty = true; }
+    void rotate(const Vector3& delta) { rotation += delta; dirty = true; }
+    void setPosition(const Vector3& value) { position = value; dirty = true; }
+    void setRotation(const Vector3& value) { rotation = value; dirty = true; }
+    void setScale(const Vector3& value) { scale = value; dirty = true; }
+    
+    // Returns false if the new parent is this transform or one of its descendants.
+    bool setParent(Transform* newParent) {
+        for (Transform* t = newParent; t; t = t->parent) {
+            if (t == this) return false;
+        }
+        if (parent) {
+            auto& siblings = parent->children;
+            siblings.erase(std::remove(siblings.begin(), siblings.end(), this), siblings.end());
+        }
+        parent = newParent;
+        if (parent) parent->children.push_back(this);
+        dirty = true;
+        return true;
+    }
     
-    void translate(const Vector3& delta) { position += delta; }
-    void rotate(const Vector3& delta) { rotation += delta; }
+    Transform* getParent() const { return parent; }
+    const std::vector<Transform*>& getChildren() const { return children; }
+    
+    const Matrix4& localMatrix() const { return local; }
+    const Matrix4& worldMatrix() const { return world; }
+    Vector3 worldPosition() const { return world.getTranslation(); }
+    // Bumped every time the world matrix is rebuilt.
+    unsigned int version() const { return worldVersion; }
+    
+    // Rebuilds the local matrix if needed and the world matrix if either it or
+    // the parent's changed. Returns whether the world matrix changed.
+    bool updateWorld(bool parentChanged) {
+        bool localChanged = dirty || position != builtPosition || rotation != builtRotation || scale != builtScale;
+        if (localChanged) {
+            local = Matrix4::compose(position, rotation, scale);
+            builtPosition = position;
+            builtRotation = rotation;
+            builtScale = scale;
+            dirty = false;
+        }
+        if (!localChanged && !parentChanged) return false;
+        world = parent ? parent->world * local : local;
+        worldVersion++;
+        return true;
+    }
+
+private:
+    friend class Scene;
+    Transform* parent = nullptr;
+    std::vector<Transform*> children;
+    Matrix4 local;
+    Matrix4 world;
+    Vector3 builtPosition;
+    Vector3 builtRotation;
+    Vector3 builtScale;
+    unsigned int worldVersion = 0;
+    bool dirty = true;
+    // Set while the owning entity is attached to a scene.
+    bool attached = false;
 };
 
 enum class KeyCode {
@@ -242,6 +589,7 @@ private:
 };
 
 class Entity;
+class Scene;
 
 class Component {
 public:
@@ -255,62 +603,495 @@ public:
     virtual void onLateUpdate(float deltaTime) { (void)deltaTime; }
 };
 
+struct ComponentPoolStats {
+    std::string type;
+    size_t blockSize = 0;
+    size_t blocksPerChunk = 0;
+    size_t chunks = 0;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t peak = 0;
+};
+
+class ComponentPoolBase {
+public:
+    virtual ~ComponentPoolBase() = default;
+    virtual ComponentPoolStats stats() const = 0;
+};
+
+class ComponentPools {
+public:
+    static ComponentPools& instance() {
+        static ComponentPools inst;
+        return inst;
+    }
+
+    void add(ComponentPoolBase* pool) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pools.push_back(pool);
+    }
+
+    std::vector<ComponentPoolStats> stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<ComponentPoolStats> result;
+        result.reserve(pools.size());
+        for (auto* pool : pools) {
+            result.push_back(pool->stats());
+        }
+        return result;
+    }
+
+    void printStats() const {
+        for (auto& s : stats()) {
+            std::cout << "[pool] " << s.type << ": " << s.used << "/" << s.capacity
+                      << " blocks used (peak " << s.peak << ", " << s.chunks << " chunks of "
+                      << s.blocksPerChunk << " x " << s.blockSize << " bytes)" << std::endl;
+        }
+    }
+
+private:
+    ComponentPools() = default;
+    mutable std::mutex mutex;
+    std::vector<ComponentPoolBase*> pools;
+};
+
+// Fixed-size blocks for one component type, carved out of chunks. addComponent
+// places each component and its shared_ptr control block in a single block;
+// freed blocks go on an intrusive free list and are reused before the pool
+// grows by another chunk. Systems on worker threads create and release
+// components too, so every pool is locked.
+template<typename T>
+class ComponentPool : public ComponentPoolBase {
+public:
+    // Never destroyed: components held by script VMs or other statics can
+    // still be released into it during static destruction.
+    static ComponentPool& instance() {
+        static ComponentPool* inst = new ComponentPool();
+        return *inst;
+    }
+
+    // Only affects chunks allocated after the call.
+    void setBlocksPerChunk(size_t count) {
+        std::lock_guard<std::mutex> lock(mutex);
+        blocksPerChunk = count > 0 ? count : 1;
+    }
+
+    void* allocate(size_t size, size_t align) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (blockSize == 0) {
+            blockAlign = std::max(align, alignof(FreeBlock));
+            blockSize = (std::max(size, sizeof(FreeBlock)) + blockAlign - 1) / blockAlign * blockAlign;
+        }
+        if (size > blockSize || align > blockAlign) {
+            return ::operator new(size, std::align_val_t(align));
+        }
+        if (!freeList) {
+            grow();
+        }
+        FreeBlock* block = freeList;
+        freeList = block->next;
+        used++;
+        peak = std::max(peak, used);
+        return block;
+    }
+
+    void deallocate(void* p, size_t size, size_t align) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (size > blockSize || align > blockAlign) {
+            ::operator delete(p, std::align_val_t(align));
+            return;
+        }
+        FreeBlock* block = static_cast<FreeBlock*>(p);
+        block->next = freeList;
+        freeList = block;
+        used--;
+    }
+
+    ComponentPoolStats stats() const override {
+        std::lock_guard<std::mutex> lock(mutex);
+        ComponentPoolStats s;
+        s.type = typeid(T).name();
+        s.blockSize = blockSize;
+        s.blocksPerChunk = blocksPerChunk;
+        s.chunks = chunks.size();
+        s.capacity = capacity;
+        s.used = used;
+        s.peak = peak;
+        return s;
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    ComponentPool() { ComponentPools::instance().add(this); }
+
+    void grow() {
+        unsigned char* chunk = static_cast<unsigned char*>(
+            ::operator new(blockSize * blocksPerChunk, std::align_val_t(blockAlign)));
+        chunks.push_back(chunk);
+        for (size_t i = blocksPerChunk; i-- > 0;) {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + i * blockSize);
+            block->next = freeList;
+            freeList = block;
+        }
+        capacity += blocksPerChunk;
+    }
+
+    mutable std::mutex mutex;
+    std::vector<void*> chunks;
+    FreeBlock* freeList = nullptr;
+    size_t blocksPerChunk = 64;
+    size_t blockSize = 0;
+    size_t blockAlign = 0;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t peak = 0;
+};
+
+// Allocator handed to std::allocate_shared; every rebound type draws from the
+// pool of component type T.
+template<typename U, typename T>
+class ComponentAllocator {
+public:
+    using value_type = U;
+
+    template<typename V>
+    struct rebind { using other = ComponentAllocator<V, T>; };
+
+    ComponentAllocator() = default;
+    template<typename V>
+    ComponentAllocator(const ComponentAllocator<V, T>&) {}
+
+    U* allocate(size_t n) {
+        return static_cast<U*>(ComponentPool<T>::instance().allocate(n * sizeof(U), alignof(U)));
+    }
+
+    void deallocate(U* p, size_t n) {
+        ComponentPool<T>::instance().deallocate(p, n * sizeof(U), alignof(U));
+    }
+
+    template<typename V>
+    bool operator==(const ComponentAllocator<V, T>&) const { return true; }
+    template<typename V>
+    bool operator!=(const ComponentAllocator<V, T>&) const { return false; }
+};
+
+struct EntityId {
+    static constexpr uint32_t InvalidIndex = 0xFFFFFFFFu;
+    uint32_t index = InvalidIndex;
+    uint32_t generation = 0;
+
+    EntityId() = default;
+    EntityId(uint32_t index, uint32_t generation) : index(index), generation(generation) {}
+    bool isValid() const { return index != InvalidIndex; }
+    bool operator==(const EntityId& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const EntityId& other) const { return !(*this == other); }
+};
+
+// Values live in reusable slots; a handle stays valid until its slot is freed,
+// after which the bumped generation makes the old handle resolve to nothing.
+template<typename T>
+class SlotMap {
+public:
+    EntityId insert(T value) {
+        uint32_t index;
+        if (!freeList.empty()) {
+            index = freeList.back();
+            freeList.pop_back();
+        } else {
+            index = static_cast<uint32_t>(slots.size());
+            slots.emplace_back();
+        }
+        Slot& slot = slots[index];
+        slot.value = std::move(value);
+        slot.occupied = true;
+        count++;
+        return EntityId(index, slot.generation);
+    }
+
+    bool erase(EntityId id) {
+        if (!contains(id)) return false;
+        Slot& slot = slots[id.index];
+        slot.value = T();
+        slot.occupied = false;
+        slot.generation++;
+        freeList.push_back(id.index);
+        count--;
+        return true;
+    }
+
+    bool contains(EntityId id) const {
+        return id.index < slots.size() && slots[id.index].occupied && slots[id.index].generation == id.generation;
+    }
+
+    T* get(EntityId id) { return contains(id) ? &slots[id.index].value : nullptr; }
+    const T* get(EntityId id) const { return contains(id) ? &slots[id.index].value : nullptr; }
+    size_t size() const { return count; }
+
+    template<typename Fn>
+    void forEach(Fn&& fn) {
+        for (auto& slot : slots) {
+            if (slot.occupied) fn(slot.value);
+        }
+    }
+
+    void clear() {
+        for (uint32_t i = 0; i < slots.size(); i++) {
+            if (slots[i].occupied) erase(EntityId(i, slots[i].generation));
+        }
+    }
+
+private:
+    struct Slot {
+        T value = T();
+        uint32_t generation = 1;
+        bool occupied = false;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeList;
+    size_t count = 0;
+};
+
+using ComponentTypeId = uint32_t;
+constexpr size_t MaxComponentTypes = 64;
+using ComponentSignature = std::bitset<MaxComponentTypes>;
+
+inline ComponentTypeId nextComponentTypeId() {
+    static std::atomic<ComponentTypeId> counter{0};
+    ComponentTypeId id = counter.fetch_add(1, std::memory_order_relaxed);
+    if (id >= MaxComponentTypes) {
+        throw std::runtime_error("Too many component types (raise MaxComponentTypes)");
+    }
+    return id;
+}
+
+// Small dense integer per type, assigned on first use.
+template<typename T>
+ComponentTypeId componentTypeId() {
+    static const ComponentTypeId id = nextComponentTypeId();
+    return id;
+}
+
+// Lets scripts refer to component types by name in queries.
+class ComponentNames {
+public:
+    static ComponentNames& instance() {
+        static ComponentNames inst;
+        return inst;
+    }
+
+    template<typename T>
+    void add(const std::string& name) { ids[name] = componentTypeId<T>(); }
+
+    bool find(const std::string& name, ComponentTypeId& id) const {
+        auto it = ids.find(name);
+        if (it == ids.end()) return false;
+        id = it->second;
+        return true;
+    }
+
+private:
+    ComponentNames() = default;
+    std::unordered_map<std::string, ComponentTypeId> ids;
+};
+
+template<typename T>
+void registerComponentName(const std::string& name) {
+    ComponentNames::instance().add<T>(name);
+}
+
+// Every entity with the same set of component types shares one archetype.
+// Components are kept column-wise (one column per type), rows are entities.
+// The components themselves come from per-type ComponentPool chunks.
+class Archetype {
+public:
+    const ComponentSignature signature;
+    std::vector<ComponentTypeId> types;
+    std::unordered_map<ComponentTypeId, Archetype*> addTransitions;
+    std::unordered_map<ComponentTypeId, Archetype*> removeTransitions;
+
+    explicit Archetype(const ComponentSignature& sig) : signature(sig) {
+        columnIndex.fill(-1);
+        for (size_t t = 0; t < MaxComponentTypes; t++) {
+            if (!signature.test(t)) continue;
+            columnIndex[t] = static_cast<int16_t>(types.size());
+            types.push_back(static_cast<ComponentTypeId>(t));
+        }
+        columns.resize(types.size());
+    }
+
+    int columnOf(ComponentTypeId type) const { return columnIndex[type]; }
+    size_t columnCount() const { return types.size(); }
+
+    size_t size() const { return rows.size(); }
+    Entity* entityAt(size_t row) const { return rows[row]; }
+    std::vector<std::shared_ptr<Component>>& column(size_t c) { return columns[c]; }
+    std::shared_ptr<Component>& at(size_t column, size_t row) { return columns[column][row]; }
+    const std::shared_ptr<Component>& at(size_t column, size_t row) const { return columns[column][row]; }
+
+    size_t addRow(Entity* entity) {
+        rows.push_back(entity);
+        active.push_back(1);
+        for (auto& column : columns) {
+            column.emplace_back();
+        }
+        return rows.size() - 1;
+    }
+
+    void removeRow(size_t row);
+    void update(float deltaTime);
+    void lateUpdate(float deltaTime);
+
+private:
+    void refreshActive();
+
+    std::vector<Entity*> rows;
+    // Entity::active per row, copied once per pass so the column loops
+    // never touch the entities.
+    std::vector<uint8_t> active;
+    std::vector<std::vector<std::shared_ptr<Component>>> columns;
+    std::array<int16_t, MaxComponentTypes> columnIndex;
+};
+
+// Each scene has its own registry holding the components of its attached
+// entities, so its updates only ever see its own rows. Entities that are
+// not attached keep theirs in the shared detached() registry, which is
+// never updated.
+class ArchetypeRegistry {
+public:
+    ArchetypeRegistry() = default;
+    ArchetypeRegistry(const ArchetypeRegistry&) = delete;
+    ArchetypeRegistry& operator=(const ArchetypeRegistry&) = delete;
+
+    // Never destroyed, like ComponentPool, since entities held by statics
+    // can outlive it.
+    static ArchetypeRegistry& detached() {
+        static ArchetypeRegistry* inst = new ArchetypeRegistry();
+        return *inst;
+    }
+
+    Archetype* withComponent(Archetype* from, ComponentTypeId type) {
+        auto& transitions = from ? from->addTransitions : rootTransitions;
+        auto it = transitions.find(type);
+        if (it != transitions.end()) return it->second;
+        ComponentSignature sig = from ? from->signature : ComponentSignature();
+        sig.set(type);
+        Archetype* target = getOrCreate(sig);
+        transitions[type] = target;
+        return target;
+    }
+
+    Archetype* withoutComponent(Archetype* from, ComponentTypeId type) {
+        auto it = from->removeTransitions.find(type);
+        if (it != from->removeTransitions.end()) return it->second;
+        ComponentSignature sig = from->signature;
+        sig.reset(type);
+        Archetype* target = sig.none() ? nullptr : getOrCreate(sig);
+        from->removeTransitions[type] = target;
+        return target;
+    }
+
+    const std::vector<Archetype*>& all() const { return archetypeList; }
+
+    Archetype* getOrCreate(const ComponentSignature& sig) {
+        auto it = archetypes.find(sig);
+        if (it != archetypes.end()) return it->second.get();
+        auto archetype = std::make_unique<Archetype>(sig);
+        Archetype* ptr = archetype.get();
+        archetypes[sig] = std::move(archetype);
+        archetypeList.push_back(ptr);
+        return ptr;
+    }
+
+private:
+    std::unordered_map<ComponentSignature, std::unique_ptr<Archetype>> archetypes;
+    std::vector<Archetype*> archetypeList;
+    std::unordered_map<ComponentTypeId, Archetype*> rootTransitions;
+};
+
 class Entity : public std::enable_shared_from_this<Entity> {
 public:
     Transform transform;
     std::string name;
     std::string tag;
     bool active = true;
-    
+    EntityId id;
+    Scene* scene = nullptr;
+
     Entity(const std::string& name = "Entity") : name(name) {}
+    Entity(const Entity&) = delete;
+    Entity& operator=(const Entity&) = delete;
     virtual ~Entity() {
-        for (auto& [type, comp] : components) {
-            comp->onDetach();
+        if (!archetype) return;
+        for (size_t c = 0; c < archetype->columnCount(); c++) {
+            archetype->at(c, archetypeRow)->onDetach();
         }
+        setArchetype(nullptr);
     }
-    
+
+    // While the entity's scene is updating, the component is only attached
+    // once the scene applies its command buffer, so getComponent() does not
+    // see it until then.
     template<typename T, typename... Args>
     std::shared_ptr<T> addComponent(Args&&... args) {
-        auto comp = std::make_shared<T>(std::forward<Args>(args)...);
+        std::shared_ptr<T> comp = std::allocate_shared<T>(ComponentAllocator<T, T>(), std::forward<Args>(args)...);
         comp->entity = this;
-        components[std::type_index(typeid(T))] = comp;
-        comp->onAttach();
+        if (deferring()) deferAttach(componentTypeId<T>(), comp);
+        else attachComponent(componentTypeId<T>(), comp);
         return comp;
     }
-    
+
     template<typename T>
     std::shared_ptr<T> getComponent() {
-        auto it = components.find(std::type_index(typeid(T)));
-        if (it != components.end()) {
-            return std::static_pointer_cast<T>(it->second);
-        }
-        return nullptr;
+        if (!archetype) return nullptr;
+        int column = archetype->columnOf(componentTypeId<T>());
+        if (column < 0) return nullptr;
+        return std::static_pointer_cast<T>(archetype->at(column, archetypeRow));
     }
-    
+
     template<typename T>
     bool hasComponent() const {
-        return components.find(std::type_index(typeid(T))) != components.end();
+        return signature().test(componentTypeId<T>());
     }
-    
+
+    const ComponentSignature& signature() const {
+        static const ComponentSignature empty;
+        return archetype ? archetype->signature : empty;
+    }
+
+    // Deferred like addComponent() while the scene is updating.
     template<typename T>
     void removeComponent() {
-        auto it = components.find(std::type_index(typeid(T)));
-        if (it != components.end()) {
-            it->second->onDetach();
-            components.erase(it);
-        }
+        if (deferring()) deferDetach(componentTypeId<T>());
+        else detachComponent(componentTypeId<T>());
     }
-    
+
+    // Use these instead of assigning name/tag directly once the entity is in a
+    // scene, so the scene's lookup indexes stay in sync.
+    void setName(const std::string& value);
+    void setTag(const std::string& value);
+
+    bool setParent(Entity* parent) { return transform.setParent(parent ? &parent->transform : nullptr); }
+
+    bool isAttached() const { return sceneIndex != DetachedIndex; }
+
     void updateComponents(float deltaTime) {
-        for (auto& [type, comp] : components) {
+        if (!archetype) return;
+        for (size_t c = 0; c < archetype->columnCount(); c++) {
+            auto& comp = archetype->at(c, archetypeRow);
             if (comp->enabled) {
                 comp->onUpdate(deltaTime);
             }
         }
     }
-    
+
     void lateUpdateComponents(float deltaTime) {
-        for (auto& [type, comp] : components) {
+        if (!archetype) return;
+        for (size_t c = 0; c < archetype->columnCount(); c++) {
+            auto& comp = archetype->at(c, archetypeRow);
             if (comp->enabled) {
                 comp->onLateUpdate(deltaTime);
             }
@@ -318,13 +1099,122 @@ public:
     }
 
 private:
-    std::unordered_map<std::type_index, std::shared_ptr<Component>> components;
+    friend class Archetype;
+    friend class Scene;
+    static constexpr size_t DetachedIndex = static_cast<size_t>(-1);
+
+    bool deferring() const;
+    void deferAttach(ComponentTypeId type, std::shared_ptr<Component> comp);
+    void deferDetach(ComponentTypeId type);
+
+    // Replaces any component of the same type, detaching it first.
+    void attachComponent(ComponentTypeId type, std::shared_ptr<Component> comp) {
+        int column = archetype ? archetype->columnOf(type) : -1;
+        if (column < 0) {
+            setArchetype(registry->withComponent(archetype, type));
+            column = archetype->columnOf(type);
+        } else {
+            archetype->at(column, archetypeRow)->onDetach();
+        }
+        archetype->at(column, archetypeRow) = comp;
+        comp->onAttach();
+    }
+
+    void detachComponent(ComponentTypeId type) {
+        if (!archetype) return;
+        int column = archetype->columnOf(type);
+        if (column < 0) return;
+        archetype->at(column, archetypeRow)->onDetach();
+        setArchetype(registry->withoutComponent(archetype, type));
+    }
+
+    // Moves the entity's row, without detaching its components, when it
+    // joins or leaves a scene.
+    void setRegistry(ArchetypeRegistry& target) {
+        if (registry == &target) return;
+        registry = &target;
+        if (archetype) setArchetype(target.getOrCreate(archetype->signature));
+    }
+
+    void setArchetype(Archetype* target) {
+        size_t newRow = 0;
+        if (target) {
+            newRow = target->addRow(this);
+            if (archetype) {
+                for (size_t c = 0; c < archetype->columnCount(); c++) {
+                    int dst = target->columnOf(archetype->types[c]);
+                    if (dst >= 0) {
+                        target->at(dst, newRow) = std::move(archetype->at(c, archetypeRow));
+                    }
+                }
+            }
+        }
+        if (archetype) {
+            archetype->removeRow(archetypeRow);
+        }
+        archetype = target;
+        archetypeRow = newRow;
+    }
+
+    ArchetypeRegistry* registry = &ArchetypeRegistry::detached();
+    Archetype* archetype = nullptr;
+    size_t archetypeRow = 0;
+    size_t sceneIndex = DetachedIndex;
 };
 
-class Shader {
-public:
-    std::string name;
-    std::string vertexPath;
+inline void Archetype::removeRow(size_t row) {
+    size_t last = rows.size() - 1;
+    if (row != last) {
+        rows[row] = rows[last];
+        rows[row]->archetypeRow = row;
+        active[row] = active[last];
+        for (auto& column : columns) {
+            column[row] = std::move(column[last]);
+        }
+    }
+    rows.pop_back();
+    active.pop_back();
+    for (auto& column : columns) {
+        column.pop_back();
+    }
+}
+
+inline void Archetype::refreshActive() {
+    for (size_t row = 0; row < rows.size(); row++) {
+        active[row] = rows[row]->active;
+    }
+}
+
+inline void Archetype::update(float deltaTime) {
+    refreshActive();
+    for (auto& column : columns) {
+        for (size_t row = 0; row < rows.size(); row++) {
+            if (!active[row]) continue;
+            Component* comp = column[row].get();
+            if (comp->enabled) {
+                comp->onUpdate(deltaTime);
+            }
+        }
+    }
+}
+
+inline void Archetype::lateUpdate(float deltaTime) {
+    refreshActive();
+    for (auto& column : columns) {
+        for (size_t row = 0; row < rows.size(); row++) {
+            if (!active[row]) continue;
+            Component* comp = column[row].get();
+            if (comp->enabled) {
+                comp->onLateUpdate(deltaTime);
+            }
+        }
+    }
+}
+
+class Shader {
+public:
+    std::string name;
+    std::string vertexPath;
     std::string fragmentPath;
     std::string vertexSource;
     std::string fragmentSource;
@@ -375,51 +1265,615 @@ struct Vertex {
     Vertex(const Vector3& pos, const Vector3& norm, const Vector2& uv) : position(pos), normal(norm), texCoord(uv), color(Color::white()) {}
 };
 
-class Mesh : public Entity {
+// How a mesh's vertices are laid out for the GPU. Positions stay three
+// floats; the other attributes can be packed or left out. Normals pack into
+// signed 10_10_10_2, texture coordinates into half floats (fine for UVs in a
+// few repeats of [0, 1]) and colours into RGBA8. Renderers feed omitted
+// attributes a constant, and colours are omitted whenever every vertex is
+// white. The default is the compact layout: 20 bytes a vertex, or 24 with
+// colours, against 48 for full().
+struct VertexFormat {
+    enum class Normals : uint8_t { Float, Packed, None };
+    enum class TexCoords : uint8_t { Float, Half, None };
+    enum class Colors : uint8_t { Float, RGBA8, None };
+
+    Normals normals = Normals::Packed;
+    TexCoords texCoords = TexCoords::Half;
+    Colors colors = Colors::RGBA8;
+
+    static VertexFormat compact() { return VertexFormat(); }
+    static VertexFormat full() { return VertexFormat{Normals::Float, TexCoords::Float, Colors::Float}; }
+
+    bool operator==(const VertexFormat& other) const {
+        return normals == other.normals && texCoords == other.texCoords && colors == other.colors;
+    }
+    bool operator!=(const VertexFormat& other) const { return !(*this == other); }
+
+    size_t normalOffset() const { return 3 * sizeof(float); }
+    size_t texCoordOffset() const { return normalOffset() + (normals == Normals::Float ? 12 : normals == Normals::Packed ? 4 : 0); }
+    size_t colorOffset() const { return texCoordOffset() + (texCoords == TexCoords::Float ? 8 : texCoords == TexCoords::Half ? 4 : 0); }
+    size_t stride() const { return colorOffset() + (colors == Colors::Float ? 16 : colors == Colors::RGBA8 ? 4 : 0); }
+
+    // The layout actually uploaded for `vertices`.
+    VertexFormat resolve(const std::vector<Vertex>& vertices) const {
+        VertexFormat format = *this;
+        bool white = std::all_of(vertices.begin(), vertices.end(), [](const Vertex& v) {
+            return v.color.r == 1.0f && v.color.g == 1.0f && v.color.b == 1.0f && v.color.a == 1.0f;
+        });
+        if (white) format.colors = Colors::None;
+        return format;
+    }
+
+    void pack(const std::vector<Vertex>& vertices, std::vector<uint8_t>& out) const {
+        pack(vertices.data(), vertices.size(), out);
+    }
+
+    void pack(const Vertex* vertices, size_t count, std::vector<uint8_t>& out) const {
+        out.resize(count * stride());
+        pack(vertices, count, out.data());
+    }
+
+    // Writes count * stride() bytes to `out`, which may be mapped GPU memory.
+    void pack(const Vertex* vertices, size_t count, uint8_t* out) const {
+        size_t size = stride();
+        for (size_t i = 0; i < count; i++) {
+            const Vertex& v = vertices[i];
+            uint8_t* dst = out + i * size;
+            const float position[] = {v.position.x, v.position.y, v.position.z};
+            std::memcpy(dst, position, sizeof(position));
+            if (normals == Normals::Float) {
+                const float normal[] = {v.normal.x, v.normal.y, v.normal.z};
+                std::memcpy(dst + normalOffset(), normal, sizeof(normal));
+            } else if (normals == Normals::Packed) {
+                uint32_t normal = packNormal(v.normal);
+                std::memcpy(dst + normalOffset(), &normal, sizeof(normal));
+            }
+            if (texCoords == TexCoords::Float) {
+                const float uv[] = {v.texCoord.x, v.texCoord.y};
+                std::memcpy(dst + texCoordOffset(), uv, sizeof(uv));
+            } else if (texCoords == TexCoords::Half) {
+                const uint16_t uv[] = {toHalf(v.texCoord.x), toHalf(v.texCoord.y)};
+                std::memcpy(dst + texCoordOffset(), uv, sizeof(uv));
+            }
+            if (colors == Colors::Float) {
+                const float color[] = {v.color.r, v.color.g, v.color.b, v.color.a};
+                std::memcpy(dst + colorOffset(), color, sizeof(color));
+            } else if (colors == Colors::RGBA8) {
+                const uint8_t color[] = {toUnorm8(v.color.r), toUnorm8(v.color.g), toUnorm8(v.color.b), toUnorm8(v.color.a)};
+                std::memcpy(dst + colorOffset(), color, sizeof(color));
+            }
+        }
+    }
+
+    // IEEE half, rounding to nearest; out-of-range values become infinity.
+    static uint16_t toHalf(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        uint32_t sign = (bits >> 16) & 0x8000u;
+        uint32_t mantissa = bits & 0x7fffffu;
+        int exponent = static_cast<int>((bits >> 23) & 0xffu) - 127 + 15;
+        if (((bits >> 23) & 0xffu) == 0xffu) return static_cast<uint16_t>(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+        if (exponent >= 31) return static_cast<uint16_t>(sign | 0x7c00u);
+        if (exponent <= 0) {
+            if (exponent < -10) return static_cast<uint16_t>(sign);
+            mantissa |= 0x800000u;
+            int shift = 14 - exponent;
+            uint32_t half = mantissa >> shift;
+            if ((mantissa >> (shift - 1)) & 1u) half++;
+            return static_cast<uint16_t>(sign | half);
+        }
+        uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+        if (mantissa & 0x1000u) half++;
+        return static_cast<uint16_t>(half);
+    }
+
+    // Signed normalized x, y, z in 10 bits each (GL_INT_2_10_10_10_REV).
+    static uint32_t packNormal(const Vector3& n) {
+        auto snorm10 = [](float v) {
+            int i = static_cast<int>(std::lround(std::clamp(v, -1.0f, 1.0f) * 511.0f));
+            return static_cast<uint32_t>(i) & 0x3ffu;
+        };
+        return snorm10(n.x) | (snorm10(n.y) << 10) | (snorm10(n.z) << 20);
+    }
+
+    static uint8_t toUnorm8(float v) {
+        return static_cast<uint8_t>(std::lround(std::clamp(v, 0.0f, 1.0f) * 255.0f));
+    }
+};
+
+// A mesh's triangles regrouped four at a time as first vertex plus two edges
+// in structure-of-arrays form, so one SSE pass of Moller-Trumbore tests a
+// whole packet. Padding and out-of-range triangles are left degenerate, which
+// no ray hits. Triangle n is lane n % 4 of packet n / 4.
+struct TrianglePackets {
+    struct alignas(16) Packet {
+        float v0[3][4];
+        float e1[3][4];
+        float e2[3][4];
+    };
+
+    std::vector<Packet> packets;
+    size_t count = 0;
+
+    void build(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices) {
+        count = (indices.empty() ? vertices.size() : indices.size()) / 3;
+        packets.assign((count + 3) / 4, Packet{});
+        for (size_t t = 0; t < count; t++) {
+            size_t a = indices.empty() ? t * 3 : indices[t * 3];
+            size_t b = indices.empty() ? t * 3 + 1 : indices[t * 3 + 1];
+            size_t c = indices.empty() ? t * 3 + 2 : indices[t * 3 + 2];
+            if (a >= vertices.size() || b >= vertices.size() || c >= vertices.size()) continue;
+            const Vector3& p0 = vertices[a].position;
+            Vector3 e1 = vertices[b].position - p0;
+            Vector3 e2 = vertices[c].position - p0;
+            Packet& packet = packets[t / 4];
+            size_t lane = t % 4;
+            packet.v0[0][lane] = p0.x; packet.v0[1][lane] = p0.y; packet.v0[2][lane] = p0.z;
+            packet.e1[0][lane] = e1.x; packet.e1[1][lane] = e1.y; packet.e1[2][lane] = e1.z;
+            packet.e2[0][lane] = e2.x; packet.e2[1][lane] = e2.y; packet.e2[2][lane] = e2.z;
+        }
+    }
+
+    // Unnormalized face normal, wound like the triangle.
+    Vector3 normal(int triangle) const {
+        const Packet& packet = packets[triangle / 4];
+        int lane = triangle % 4;
+        return Vector3::cross(Vector3(packet.e1[0][lane], packet.e1[1][lane], packet.e1[2][lane]),
+                              Vector3(packet.e2[0][lane], packet.e2[1][lane], packet.e2[2][lane]));
+    }
+
+    // Nearest triangle the ray hits from both sides with 0 <= t < maxT, in
+    // units of `direction`, which need not be normalized.
+    bool raycast(const Vector3& origin, const Vector3& direction, float maxT, float& hitT, int& triangle) const {
+        const float epsilon = 1e-12f;
+        float best = maxT;
+        triangle = -1;
+#ifdef COMBINE_SSE
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), eps = _mm_set1_ps(epsilon);
+        const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+        const __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+        for (size_t i = 0; i < packets.size(); i++) {
+            const Packet& packet = packets[i];
+            __m128 e1x = _mm_load_ps(packet.e1[0]), e1y = _mm_load_ps(packet.e1[1]), e1z = _mm_load_ps(packet.e1[2]);
+            __m128 e2x = _mm_load_ps(packet.e2[0]), e2y = _mm_load_ps(packet.e2[1]), e2z = _mm_load_ps(packet.e2[2]);
+            __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+            __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+            __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+            __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+            __m128 mask = _mm_cmpgt_ps(_mm_andnot_ps(signMask, det), eps);
+            if (!_mm_movemask_ps(mask)) continue;
+            __m128 invDet = _mm_div_ps(one, det);
+            __m128 tx = _mm_sub_ps(ox, _mm_load_ps(packet.v0[0]));
+            __m128 ty = _mm_sub_ps(oy, _mm_load_ps(packet.v0[1]));
+            __m128 tz = _mm_sub_ps(oz, _mm_load_ps(packet.v0[2]));
+            __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+            __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+            __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+            __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+            __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+            __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+            mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)));
+            mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+            mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmplt_ps(t, _mm_set1_ps(best))));
+            int lanes = _mm_movemask_ps(mask);
+            if (!lanes) continue;
+            alignas(16) float ts[4];
+            _mm_store_ps(ts, t);
+            for (int lane = 0; lane < 4; lane++) {
+                if ((lanes & (1 << lane)) && ts[lane] < best) {
+                    best = ts[lane];
+                    triangle = static_cast<int>(i * 4 + lane);
+                }
+            }
+        }
+#else
+        for (size_t i = 0; i < packets.size(); i++) {
+            const Packet& packet = packets[i];
+            for (int lane = 0; lane < 4; lane++) {
+                Vector3 e1(packet.e1[0][lane], packet.e1[1][lane], packet.e1[2][lane]);
+                Vector3 e2(packet.e2[0][lane], packet.e2[1][lane], packet.e2[2][lane]);
+                Vector3 p = Vector3::cross(direction, e2);
+                float det = Vector3::dot(e1, p);
+                if (std::fabs(det) <= epsilon) continue;
+                float invDet = 1.0f / det;
+                Vector3 tvec = origin - Vector3(packet.v0[0][lane], packet.v0[1][lane], packet.v0[2][lane]);
+                float u = Vector3::dot(tvec, p) * invDet;
+                if (u < 0.0f || u > 1.0f) continue;
+                Vector3 q = Vector3::cross(tvec, e1);
+                float v = Vector3::dot(direction, q) * invDet;
+                if (v < 0.0f || u + v > 1.0f) continue;
+                float t = Vector3::dot(e2, q) * invDet;
+                if (t >= 0.0f && t < best) {
+                    best = t;
+                    triangle = static_cast<int>(i * 4 + lane);
+                }
+            }
+        }
+#endif
+        if (triangle < 0) return false;
+        hitT = best;
+        return true;
+    }
+};
+
+// Hands the ids of destroyed geometry to the renderer so it can free the GPU
+// buffers it uploaded for them.
+class GeometryReleaseQueue {
 public:
+    static GeometryReleaseQueue& instance() {
+        static GeometryReleaseQueue queue;
+        return queue;
+    }
+
+    void push(unsigned int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        released.push_back(id);
+    }
+
+    std::vector<unsigned int> take() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<unsigned int> ids;
+        ids.swap(released);
+        return ids;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<unsigned int> released;
+};
+
+// Half-open range of elements changed since the GPU copy was last synced.
+struct DirtyRange {
+    size_t begin = 0;
+    size_t end = 0;
+
+    bool empty() const { return begin >= end; }
+
+    void add(size_t first, size_t last) {
+        if (first >= last) return;
+        if (empty()) {
+            begin = first;
+            end = last;
+        } else {
+            begin = std::min(begin, first);
+            end = std::max(end, last);
+        }
+    }
+
+    static DirtyRange all() { return {0, std::numeric_limits<size_t>::max()}; }
+};
+
+// Vertex and index data that any number of meshes can share. `id` identifies
+// the geometry to renderer caches and `version` is bumped on every edit so
+// they know when to upload again. `format` is the layout renderers upload
+// the vertices in. Shared geometry is frozen; Mesh copies it before editing.
+struct MeshData {
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indices;
+    VertexFormat format;
+    unsigned int version = 0;
+    bool frozen = false;
+    const unsigned int id;
+
+    MeshData() : id(nextId()) {}
+    MeshData(const MeshData& other) : vertices(other.vertices), indices(other.indices), format(other.format), id(nextId()) {}
+    MeshData& operator=(const MeshData&) = delete;
+    ~MeshData() { GeometryReleaseQueue::instance().push(id); }
+
+    // Elements edited since the renderer last synced its buffers, valid for
+    // every edit made after syncedVersion. Edits that cannot say what they
+    // touched mark everything.
+    void markVertices(size_t begin, size_t end) { dirtyVertices.add(begin, end); }
+    void markIndices(size_t begin, size_t end) { dirtyIndices.add(begin, end); }
+    void markAll() {
+        dirtyVertices = DirtyRange::all();
+        dirtyIndices = DirtyRange::all();
+    }
+
+    const DirtyRange& dirtyVertexRange() const { return dirtyVertices; }
+    const DirtyRange& dirtyIndexRange() const { return dirtyIndices; }
+    unsigned int syncedVersion() const { return synced; }
+
+    void markSynced() const {
+        dirtyVertices = DirtyRange();
+        dirtyIndices = DirtyRange();
+        synced = version;
+    }
+
+    // Local-space bounds, recomputed the first time they are asked for after
+    // an edit.
+    const BoundingBox& bounds() const {
+        updateBounds();
+        return box;
+    }
+
+    const BoundingSphere& boundingSphere() const {
+        updateBounds();
+        return sphere;
+    }
+
+    // Triangles packed for ray tests, rebuilt on first use after an edit.
+    const TrianglePackets& triangles() const {
+        if (trianglesVersion != version || !trianglesValid) {
+            triangleCache.build(vertices, indices);
+            trianglesVersion = version;
+            trianglesValid = true;
+        }
+        return triangleCache;
+    }
+
+private:
+    void updateBounds() const {
+        if (boundsVersion == version && boundsValid) return;
+        box = BoundingBox();
+        for (const auto& v : vertices) {
+            box.expand(v.position);
+        }
+        sphere.center = box.empty() ? Vector3() : box.center();
+        float radiusSq = 0.0f;
+        for (const auto& v : vertices) {
+            Vector3 d = v.position - sphere.center;
+            radiusSq = std::max(radiusSq, Vector3::dot(d, d));
+        }
+        sphere.radius = std::sqrt(radiusSq);
+        boundsVersion = version;
+        boundsValid = true;
+    }
+
+    mutable BoundingBox box;
+    mutable BoundingSphere sphere;
+    mutable unsigned int boundsVersion = 0;
+    mutable bool boundsValid = false;
+    mutable TrianglePackets triangleCache;
+    mutable unsigned int trianglesVersion = 0;
+    mutable bool trianglesValid = false;
+    mutable DirtyRange dirtyVertices;
+    mutable DirtyRange dirtyIndices;
+    mutable unsigned int synced = 0;
+
+    static unsigned int nextId() {
+        static std::atomic<unsigned int> next{1};
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+// Deduplicates generated primitives: every cube, and every sphere or plane
+// with the same parameters, shares one frozen MeshData for as long as any mesh
+// still uses it.
+class PrimitiveCache {
+public:
+    enum class Type { Cube, Plane, Sphere };
+
+    static PrimitiveCache& instance() {
+        static PrimitiveCache cache;
+        return cache;
+    }
+
+    template<typename Build>
+    std::shared_ptr<MeshData> get(Type type, int segments, int rings, float width, float height, Build&& build) {
+        Key key{type, segments, rings, width, height};
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            if (auto data = it->second.lock()) return data;
+        }
+        auto data = std::make_shared<MeshData>();
+        build(*data);
+        data->frozen = true;
+        entries[key] = data;
+        return data;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = entries.begin(); it != entries.end();) {
+            it = it->second.expired() ? entries.erase(it) : std::next(it);
+        }
+        return entries.size();
+    }
+
+private:
+    using Key = std::tuple<Type, int, int, float, float>;
+
+    std::mutex mutex;
+    std::map<Key, std::weak_ptr<MeshData>> entries;
+};
+
+// Geometry levels for a MeshRenderer, most detailed first. A level is drawn
+// while the entity's bounding sphere covers at least `screenSize` of the
+// screen height; the last level is kept however small the entity gets.
+// Levels only switch once the size is `hysteresis` past a threshold, so
+// objects sitting on one don't flicker between levels. Groups can be shared
+// by any number of renderers.
+struct LODGroup {
+    struct Level {
+        std::shared_ptr<const MeshData> geometry;
+        float screenSize = 0.0f;
+    };
+
+    // Largest geometric error, as a fraction of the screen height, that
+    // generated chains let a level show before switching to a finer one.
+    static constexpr float ScreenError = 0.001f;
+
+    std::vector<Level> levels;
+    float hysteresis = 0.15f;
+
+    // Levels are kept sorted by screenSize. Geometry handed over mutable is
+    // frozen like Mesh::setGeometry does; a mesh whose own geometry is a
+    // level copies it before editing anyway, since it is shared.
+    void addLevel(std::shared_ptr<MeshData> geometry, float screenSize) {
+        if (geometry) geometry->frozen = true;
+        addLevel(std::shared_ptr<const MeshData>(std::move(geometry)), screenSize);
+    }
+
+    void addLevel(std::shared_ptr<const MeshData> geometry, float screenSize) {
+        if (!geometry) return;
+        auto it = std::find_if(levels.begin(), levels.end(), [screenSize](const Level& level) {
+            return level.screenSize < screenSize;
+        });
+        levels.insert(it, Level{std::move(geometry), screenSize});
+    }
+
+    size_t select(float screenSize, size_t current) const {
+        if (levels.empty()) return 0;
+        size_t target = levels.size() - 1;
+        for (size_t i = 0; i < levels.size(); i++) {
+            if (screenSize >= levels[i].screenSize) {
+                target = i;
+                break;
+            }
+        }
+        if (current >= levels.size()) return target;
+        if (target > current) {
+            return screenSize >= levels[current].screenSize * (1.0f - hysteresis) ? current : target;
+        }
+        while (target < current && screenSize < levels[target].screenSize * (1.0f + hysteresis)) {
+            target++;
+        }
+        return target;
+    }
+};
+
+class Mesh;
+
+// Marks an entity as drawable: the renderer draws `mesh`'s geometry with the
+// owning entity's world transform. Every Mesh carries one pointing at itself;
+// other entities can add one to reuse a mesh's geometry. Scenes keep the
+// attached ones in a dense list so the render pass only visits drawables.
+class MeshRenderer : public Component {
+public:
+    Mesh* mesh = nullptr;
+    std::shared_ptr<Mesh> sharedMesh;
+    Color tint;
+
+    explicit MeshRenderer(Mesh* mesh = nullptr) : mesh(mesh) {}
+    explicit MeshRenderer(std::shared_ptr<Mesh> shared) : mesh(shared.get()), sharedMesh(std::move(shared)) {}
+
+    void onAttach() override;
+    void onDetach() override;
+
+    // World-space box as of the last Scene::updateSpatialIndex().
+    const BoundingBox& worldBounds() const { return bounds; }
+
+    // The geometry to draw: the selected level of the mesh's LOD chain, or
+    // the mesh's own geometry when it has none.
+    const MeshData* geometry() const;
+    size_t lodLevel() const { return level; }
+    // Picks the LOD level for the fraction of the screen height the entity
+    // covers. Called by the engine for every visible renderable.
+    void selectLOD(float screenSize);
+
+private:
+    friend class Scene;
+    size_t level = 0;
+    static constexpr size_t Unregistered = static_cast<size_t>(-1);
+    size_t renderIndex = Unregistered;
+    int proxy = -1;
+    BoundingBox bounds;
+    const MeshData* boundsGeometry = nullptr;
+    unsigned int boundsGeometryVersion = 0;
+    unsigned int boundsTransformVersion = 0;
+
+    bool refreshBounds();
+};
+
+class Mesh : public Entity {
+public:
     Color color;
-    bool dirty = true;
-    unsigned int renderId = 0;
     std::string texturePath;
+    // Optional lower-detail versions of the geometry, level 0 being the
+    // geometry itself. Editing or replacing the geometry drops the chain.
+    std::shared_ptr<LODGroup> lod;
+    
+    Mesh(const std::string& name = "Mesh") : Entity(name), color(Color::white()), data(std::make_shared<MeshData>()) {
+        addComponent<MeshRenderer>(this);
+    }
     
-    Mesh(const std::string& name = "Mesh") : Entity(name), color(Color::white()) {}
+    const std::vector<Vertex>& vertices() const { return data->vertices; }
+    const std::vector<unsigned int>& indices() const { return data->indices; }
+    // Read-only: edits go through the mesh so shared geometry is copied
+    // first and the GPU copy knows what changed.
+    std::shared_ptr<const MeshData> geometry() const { return data; }
+    
+    // Shares `geometry` with this mesh. It is frozen so later edits through
+    // any mesh using it make a private copy first.
+    void setGeometry(std::shared_ptr<MeshData> geometry) {
+        if (!geometry) geometry = std::make_shared<MeshData>();
+        geometry->frozen = true;
+        data = std::move(geometry);
+        lod.reset();
+    }
+    
+    // Shares another mesh's or LOD level's geometry.
+    void setGeometry(std::shared_ptr<const MeshData> geometry) {
+        setGeometry(std::const_pointer_cast<MeshData>(geometry));
+    }
+    
+    // Returns the geometry for writing, copying it first if it is shared.
+    // All of it is re-uploaded; the edits below only mark what they touch.
+    MeshData& editGeometry() {
+        MeshData& geometry = touchGeometry();
+        geometry.markAll();
+        return geometry;
+    }
     
     void addVertex(const Vertex& v) {
-        vertices.push_back(v);
-        dirty = true;
+        MeshData& geometry = touchGeometry();
+        geometry.vertices.push_back(v);
+        geometry.markVertices(geometry.vertices.size() - 1, geometry.vertices.size());
     }
     
     void addVertex(float x, float y, float z) {
-        vertices.push_back(Vertex(Vector3(x, y, z)));
-        dirty = true;
+        addVertex(Vertex(Vector3(x, y, z)));
     }
     
     void addVertex(const Vector3& pos, const Vector3& normal, const Vector2& uv) {
-        vertices.push_back(Vertex(pos, normal, uv));
-        dirty = true;
+        addVertex(Vertex(pos, normal, uv));
+    }
+    
+    // Out-of-range indices are ignored.
+    void setVertex(size_t index, const Vertex& v) {
+        if (index >= data->vertices.size()) return;
+        MeshData& geometry = touchGeometry();
+        geometry.vertices[index] = v;
+        geometry.markVertices(index, index + 1);
     }
     
     void addIndex(unsigned int idx) {
-        indices.push_back(idx);
-        dirty = true;
+        MeshData& geometry = touchGeometry();
+        geometry.indices.push_back(idx);
+        geometry.markIndices(geometry.indices.size() - 1, geometry.indices.size());
     }
     
     void addTriangle(unsigned int i0, unsigned int i1, unsigned int i2) {
-        indices.push_back(i0);
-        indices.push_back(i1);
-        indices.push_back(i2);
-        dirty = true;
+        MeshData& geometry = touchGeometry();
+        geometry.indices.insert(geometry.indices.end(), {i0, i1, i2});
+        geometry.markIndices(geometry.indices.size() - 3, geometry.indices.size());
     }
     
+    // Keeps unshared geometry, and so its GPU buffers, for meshes that are
+    // rebuilt every frame.
     void clear() {
-        vertices.clear();
-        indices.clear();
-        dirty = true;
+        if (data->frozen || data.use_count() > 1) {
+            data = std::make_shared<MeshData>();
+        } else {
+            data->vertices.clear();
+            data->indices.clear();
+            data->version++;
+        }
+        lod.reset();
     }
     
     void calculateNormals() {
+        MeshData& geometry = touchGeometry();
+        calculateNormals(geometry);
+        geometry.markVertices(0, geometry.vertices.size());
+    }
+    
+    static void calculateNormals(MeshData& geometry) {
+        auto& vertices = geometry.vertices;
+        auto& indices = geometry.indices;
         for (auto& v : vertices) {
             v.normal = Vector3(0, 0, 0);
         }
@@ -445,13 +1899,52 @@ public:
         for (auto& v : vertices) {
             v.normal = v.normal.normalized();
         }
-        
-        dirty = true;
     }
     
     static std::shared_ptr<Mesh> createCube(const std::string& name = "Cube") {
         auto mesh = std::make_shared<Mesh>(name);
-        
+        mesh->setGeometry(PrimitiveCache::instance().get(PrimitiveCache::Type::Cube, 0, 0, 1.0f, 1.0f, buildCube));
+        return mesh;
+    }
+    
+    static std::shared_ptr<Mesh> createPlane(const std::string& name = "Plane", float width = 1.0f, float height = 1.0f) {
+        auto mesh = std::make_shared<Mesh>(name);
+        mesh->setGeometry(PrimitiveCache::instance().get(PrimitiveCache::Type::Plane, 0, 0, width, height,
+            [width, height](MeshData& geometry) { buildPlane(geometry, width, height); }));
+        return mesh;
+    }
+    
+    static std::shared_ptr<Mesh> createSphere(const std::string& name = "Sphere", int segments = 16, int rings = 16) {
+        auto mesh = std::make_shared<Mesh>(name);
+        mesh->setGeometry(sphereGeometry(segments, rings));
+        mesh->lod = sphereLOD(segments, rings);
+        return mesh;
+    }
+    
+    static std::shared_ptr<MeshData> sphereGeometry(int segments, int rings) {
+        return PrimitiveCache::instance().get(PrimitiveCache::Type::Sphere, segments, rings, 1.0f, 1.0f,
+            [segments, rings](MeshData& geometry) { buildSphere(geometry, segments, rings); });
+    }
+    
+    // Halves the segment and ring counts per level down to 6x4. Each level
+    // is kept until the next coarser one would be off the true silhouette by
+    // less than LODGroup::ScreenError.
+    static std::shared_ptr<LODGroup> sphereLOD(int segments, int rings) {
+        auto group = std::make_shared<LODGroup>();
+        group->levels.push_back({sphereGeometry(segments, rings), 0.0f});
+        while (segments > 6 || rings > 4) {
+            segments = std::max(segments / 2, 6);
+            rings = std::max(rings / 2, 4);
+            // Chord sag of the coarser tessellation relative to the diameter.
+            float halfStep = std::max(3.14159265f / segments, 3.14159265f / (2 * rings));
+            float sag = 0.5f * (1.0f - std::cos(halfStep));
+            group->levels.back().screenSize = LODGroup::ScreenError / sag;
+            group->levels.push_back({sphereGeometry(segments, rings), 0.0f});
+        }
+        return group;
+    }
+    
+    static void buildCube(MeshData& geometry) {
         Vector3 positions[] = {
             {-0.5f, -0.5f, -0.5f}, {0.5f, -0.5f, -0.5f}, {0.5f, 0.5f, -0.5f}, {-0.5f, 0.5f, -0.5f},
             {-0.5f, -0.5f, 0.5f}, {0.5f, -0.5f, 0.5f}, {0.5f, 0.5f, 0.5f}, {-0.5f, 0.5f, 0.5f}
@@ -466,40 +1959,34 @@ public:
         };
         
         for (int face = 0; face < 6; face++) {
-            unsigned int baseIdx = mesh->vertices.size();
+            unsigned int baseIdx = geometry.vertices.size();
             for (int i = 0; i < 4; i++) {
                 Vertex v;
                 v.position = positions[faceIndices[face][i]];
                 v.normal = normals[face];
                 v.texCoord = Vector2((i == 1 || i == 2) ? 1.0f : 0.0f, (i == 2 || i == 3) ? 1.0f : 0.0f);
-                mesh->vertices.push_back(v);
+                geometry.vertices.push_back(v);
             }
-            mesh->addTriangle(baseIdx, baseIdx + 1, baseIdx + 2);
-            mesh->addTriangle(baseIdx, baseIdx + 2, baseIdx + 3);
+            geometry.indices.insert(geometry.indices.end(), {
+                baseIdx, baseIdx + 1, baseIdx + 2,
+                baseIdx, baseIdx + 2, baseIdx + 3
+            });
         }
-        
-        return mesh;
     }
     
-    static std::shared_ptr<Mesh> createPlane(const std::string& name = "Plane", float width = 1.0f, float height = 1.0f) {
-        auto mesh = std::make_shared<Mesh>(name);
+    static void buildPlane(MeshData& geometry, float width, float height) {
         float hw = width * 0.5f;
         float hh = height * 0.5f;
         
-        mesh->addVertex(Vertex(Vector3(-hw, 0, -hh), Vector3(0, 1, 0), Vector2(0, 0)));
-        mesh->addVertex(Vertex(Vector3(hw, 0, -hh), Vector3(0, 1, 0), Vector2(1, 0)));
-        mesh->addVertex(Vertex(Vector3(hw, 0, hh), Vector3(0, 1, 0), Vector2(1, 1)));
-        mesh->addVertex(Vertex(Vector3(-hw, 0, hh), Vector3(0, 1, 0), Vector2(0, 1)));
-        
-        mesh->addTriangle(0, 1, 2);
-        mesh->addTriangle(0, 2, 3);
+        geometry.vertices.push_back(Vertex(Vector3(-hw, 0, -hh), Vector3(0, 1, 0), Vector2(0, 0)));
+        geometry.vertices.push_back(Vertex(Vector3(hw, 0, -hh), Vector3(0, 1, 0), Vector2(1, 0)));
+        geometry.vertices.push_back(Vertex(Vector3(hw, 0, hh), Vector3(0, 1, 0), Vector2(1, 1)));
+        geometry.vertices.push_back(Vertex(Vector3(-hw, 0, hh), Vector3(0, 1, 0), Vector2(0, 1)));
         
-        return mesh;
+        geometry.indices = {0, 1, 2, 0, 2, 3};
     }
     
-    static std::shared_ptr<Mesh> createSphere(const std::string& name = "Sphere", int segments = 16, int rings = 16) {
-        auto mesh = std::make_shared<Mesh>(name);
-        
+    static void buildSphere(MeshData& geometry, int segments, int rings) {
         for (int ring = 0; ring <= rings; ring++) {
             float phi = 3.14159265f * ring / rings;
             float y = std::cos(phi);
@@ -514,67 +2001,638 @@ public:
                 Vector3 normal = pos.normalized();
                 Vector2 uv((float)seg / segments, (float)ring / rings);
                 
-                mesh->addVertex(Vertex(pos, normal, uv));
+                geometry.vertices.push_back(Vertex(pos, normal, uv));
+            }
+        }
+        
+        for (int ring = 0; ring < rings; ring++) {
+            for (int seg = 0; seg < segments; seg++) {
+                unsigned int curr = ring * (segments + 1) + seg;
+                unsigned int next = curr + segments + 1;
+                
+                geometry.indices.insert(geometry.indices.end(), {
+                    curr, next, curr + 1,
+                    curr + 1, next, next + 1
+                });
+            }
+        }
+    }
+
+private:
+    MeshData& touchGeometry() {
+        if (data->frozen || data.use_count() > 1) {
+            data = std::make_shared<MeshData>(*data);
+        }
+        data->version++;
+        lod.reset();
+        return *data;
+    }
+
+    std::shared_ptr<MeshData> data;
+};
+
+inline const MeshData* MeshRenderer::geometry() const {
+    if (!mesh) return nullptr;
+    if (mesh->lod && level < mesh->lod->levels.size()) return mesh->lod->levels[level].geometry.get();
+    return mesh->geometry().get();
+}
+
+inline void MeshRenderer::selectLOD(float screenSize) {
+    level = mesh && mesh->lod ? mesh->lod->select(screenSize, level) : 0;
+}
+
+// Recomputes the world box if the transform or geometry changed since the
+// last call.
+inline bool MeshRenderer::refreshBounds() {
+    const MeshData* geometry = mesh ? mesh->geometry().get() : nullptr;
+    const Transform& transform = entity->transform;
+    if (proxy != -1 && geometry == boundsGeometry && transform.version() == boundsTransformVersion &&
+        (!geometry || geometry->version == boundsGeometryVersion)) {
+        return false;
+    }
+    bounds = geometry ? geometry->bounds().transformed(transform.worldMatrix()) : BoundingBox();
+    boundsGeometry = geometry;
+    boundsGeometryVersion = geometry ? geometry->version : 0;
+    boundsTransformVersion = transform.version();
+    return true;
+}
+
+class Camera {
+public:
+    Vector3 position;
+    Vector3 rotation;
+    float fov = 60.0f;
+    float nearPlane = 0.1f;
+    float farPlane = 1000.0f;
+    Color clearColor;
+    
+    Camera() : position(0, 0, 3), clearColor(0.1f, 0.1f, 0.15f, 1.0f) {}
+    
+    Vector3 forward() const {
+        float pitch = rotation.x * 3.14159265f / 180.0f;
+        float yaw = rotation.y * 3.14159265f / 180.0f;
+        return Vector3(
+            std::sin(yaw) * std::cos(pitch),
+            -std::sin(pitch),
+            -std::cos(yaw) * std::cos(pitch)
+        );
+    }
+    
+    Vector3 right() const {
+        float yaw = rotation.y * 3.14159265f / 180.0f;
+        return Vector3(std::cos(yaw), 0, std::sin(yaw));
+    }
+    
+    Vector3 up() const {
+        return Vector3::cross(right(), forward()).normalized();
+    }
+    
+    Matrix4 viewMatrix() const {
+        return Matrix4::rotation(rotation) * Matrix4::translation(Vector3(-position.x, -position.y, -position.z));
+    }
+    
+    Matrix4 projectionMatrix(float aspect) const {
+        return Matrix4::perspective(fov, aspect, nearPlane, farPlane);
+    }
+
+    // Unprojects a point in window coordinates (origin top-left) of a
+    // width x height viewport. The ray starts on the near plane; returns the
+    // distance along it to the far plane.
+    float screenRay(float screenX, float screenY, float width, float height, Vector3& origin, Vector3& direction) const {
+        float tanHalf = std::tan(fov * 3.14159265f / 360.0f);
+        Vector3 eye((2.0f * screenX / width - 1.0f) * tanHalf * (width / height),
+                    (1.0f - 2.0f * screenY / height) * tanHalf,
+                    -1.0f);
+        Vector3 ray = Matrix4::rotation(rotation).transformTransposed(eye);
+        origin = position + ray * nearPlane;
+        direction = ray.normalized();
+        return ray.length() * (farPlane - nearPlane);
+    }
+
+    // Fraction of the screen height covered by the box's bounding sphere;
+    // infinite once the camera is inside it.
+    float screenSize(const BoundingBox& box) const {
+        if (box.empty()) return 0.0f;
+        float radius = box.extents().length();
+        float distance = (box.center() - position).length();
+        if (distance <= radius) return std::numeric_limits<float>::infinity();
+        return radius / (distance * std::tan(fov * 3.14159265f / 360.0f));
+    }
+};
+
+struct Light {
+    enum class Type { Directional, Point, Spot };
+    
+    Type type = Type::Directional;
+    Vector3 position;
+    Vector3 direction;
+    Color color;
+    float intensity = 1.0f;
+    float range = 10.0f;
+    float spotAngle = 45.0f;
+    
+    Light() : direction(0, -1, 0), color(Color::white()) {}
+};
+
+// Incrementally updated AABB tree (in the style of Box2D's dynamic tree).
+// Leaves store a box padded by `margin` so small movements don't touch the
+// tree; internal nodes are kept balanced with AVL-style rotations. Proxy ids
+// are node indices and stay valid until remove().
+template<typename T>
+class DynamicBVH {
+public:
+    static constexpr int Null = -1;
+    float margin = 0.1f;
+
+    int insert(const BoundingBox& box, const T& payload) {
+        int leaf = allocateNode();
+        nodes[leaf].box = fatten(box);
+        nodes[leaf].payload = payload;
+        nodes[leaf].height = 0;
+        insertLeaf(leaf);
+        leafCount++;
+        return leaf;
+    }
+
+    void remove(int proxy) {
+        removeLeaf(proxy);
+        freeNode(proxy);
+        leafCount--;
+    }
+
+    // Returns true if the proxy had to be reinserted.
+    bool move(int proxy, const BoundingBox& box) {
+        const BoundingBox& fat = nodes[proxy].box;
+        if (fat.min.x <= box.min.x && fat.min.y <= box.min.y && fat.min.z <= box.min.z &&
+            fat.max.x >= box.max.x && fat.max.y >= box.max.y && fat.max.z >= box.max.z) {
+            return false;
+        }
+        removeLeaf(proxy);
+        nodes[proxy].box = fatten(box);
+        insertLeaf(proxy);
+        return true;
+    }
+
+    const T& payload(int proxy) const { return nodes[proxy].payload; }
+    const BoundingBox& fatBounds(int proxy) const { return nodes[proxy].box; }
+    size_t size() const { return leafCount; }
+    int height() const { return root == Null ? 0 : nodes[root].height; }
+
+    void clear() {
+        nodes.clear();
+        root = Null;
+        freeList = Null;
+        leafCount = 0;
+    }
+
+    // Calls fn(proxy) for every leaf whose fat box overlaps `box`; stop early
+    // by returning false.
+    template<typename Fn>
+    void query(const BoundingBox& box, Fn&& fn) const {
+        traverse([&box](const BoundingBox& nodeBox) { return nodeBox.intersects(box); }, fn);
+    }
+
+    // Visits leaves whose fat box the ray enters before `maxDistance`.
+    // fn(proxy, maxDistance) returns the new limit, so reporting a hit
+    // distance prunes everything behind it and returning 0 stops the walk.
+    template<typename Fn>
+    void raycast(const Vector3& origin, const Vector3& direction, float maxDistance, Fn&& fn) const {
+        if (root == Null) return;
+        Vector3 inv(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        stack.clear();
+        stack.push_back(root);
+        while (!stack.empty()) {
+            int index = stack.back();
+            stack.pop_back();
+            const Node& node = nodes[index];
+            float entry;
+            if (!rayBox(origin, inv, node.box, maxDistance, entry)) continue;
+            if (node.isLeaf()) {
+                maxDistance = fn(index, maxDistance);
+                if (maxDistance <= 0.0f) return;
+            } else {
+                stack.push_back(node.child1);
+                stack.push_back(node.child2);
+            }
+        }
+    }
+
+    // Best-first search for the `k` leaves with the smallest distance(proxy)
+    // up to maxDistance, nearest first. distance(proxy) must never be less
+    // than the distance from `point` to that leaf's fat box.
+    template<typename Distance>
+    std::vector<std::pair<float, int>> nearest(const Vector3& point, size_t k, float maxDistance, Distance&& distance) const {
+        std::vector<std::pair<float, int>> best;
+        if (root == Null || k == 0) return best;
+        using Entry = std::pair<float, int>;
+        std::vector<Entry> open;
+        auto closer = [](const Entry& a, const Entry& b) { return a.first > b.first; };
+        auto farther = [](const Entry& a, const Entry& b) { return a.first < b.first; };
+        open.push_back({boxDistance(point, nodes[root].box), root});
+        while (!open.empty()) {
+            std::pop_heap(open.begin(), open.end(), closer);
+            Entry entry = open.back();
+            open.pop_back();
+            float limit = best.size() == k ? best.front().first : maxDistance;
+            if (entry.first > limit) break;
+            const Node& node = nodes[entry.second];
+            if (node.isLeaf()) {
+                float d = distance(entry.second);
+                if (d > limit) continue;
+                if (best.size() == k) {
+                    std::pop_heap(best.begin(), best.end(), farther);
+                    best.pop_back();
+                }
+                best.push_back({d, entry.second});
+                std::push_heap(best.begin(), best.end(), farther);
+            } else {
+                for (int child : {node.child1, node.child2}) {
+                    open.push_back({boxDistance(point, nodes[child].box), child});
+                    std::push_heap(open.begin(), open.end(), closer);
+                }
+            }
+        }
+        std::sort_heap(best.begin(), best.end(), farther);
+        return best;
+    }
+
+    static float boxDistance(const Vector3& p, const BoundingBox& box) {
+        float dx = std::max({box.min.x - p.x, 0.0f, p.x - box.max.x});
+        float dy = std::max({box.min.y - p.y, 0.0f, p.y - box.max.y});
+        float dz = std::max({box.min.z - p.z, 0.0f, p.z - box.max.z});
+        return std::sqrt(dx * dx + dy * dy + dz * dz);
+    }
+
+    // Slab test. `inverseDirection` is 1/direction per axis; on a hit `entry`
+    // is the distance at which the ray enters the box (0 if it starts inside).
+    static bool rayBox(const Vector3& origin, const Vector3& inverseDirection, const BoundingBox& box, float maxDistance, float& entry) {
+        float tmin = -std::numeric_limits<float>::infinity();
+        float tmax = std::numeric_limits<float>::infinity();
+        if (!raySlab(origin.x, inverseDirection.x, box.min.x, box.max.x, tmin, tmax) ||
+            !raySlab(origin.y, inverseDirection.y, box.min.y, box.max.y, tmin, tmax) ||
+            !raySlab(origin.z, inverseDirection.z, box.min.z, box.max.z, tmin, tmax)) {
+            return false;
+        }
+        entry = std::max(tmin, 0.0f);
+        return tmax >= entry && entry <= maxDistance;
+    }
+
+private:
+    // A ray parallel to the slab never crosses its planes, and 0 * inf would
+    // be NaN for an origin lying on one, so that case only checks the origin.
+    static bool raySlab(float origin, float inverse, float min, float max, float& tmin, float& tmax) {
+        if (std::isinf(inverse)) return origin >= min && origin <= max;
+        float t1 = (min - origin) * inverse;
+        float t2 = (max - origin) * inverse;
+        tmin = std::max(tmin, std::min(t1, t2));
+        tmax = std::min(tmax, std::max(t1, t2));
+        return true;
+    }
+
+    struct Node {
+        BoundingBox box;
+        T payload{};
+        int parent = Null;
+        int child1 = Null;
+        int child2 = Null;
+        int height = -1;
+        bool isLeaf() const { return child1 == Null; }
+    };
+
+    std::vector<Node> nodes;
+    int root = Null;
+    int freeList = Null;
+    size_t leafCount = 0;
+    mutable std::vector<int> stack;
+
+    static float area(const BoundingBox& box) {
+        Vector3 d = box.max - box.min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    static BoundingBox merged(const BoundingBox& a, const BoundingBox& b) {
+        BoundingBox box = a;
+        box.expand(b);
+        return box;
+    }
+
+    BoundingBox fatten(const BoundingBox& box) const {
+        Vector3 pad(margin, margin, margin);
+        return BoundingBox(box.min - pad, box.max + pad);
+    }
+
+    template<typename Overlaps, typename Fn>
+    void traverse(Overlaps&& overlaps, Fn& fn) const {
+        if (root == Null) return;
+        stack.clear();
+        stack.push_back(root);
+        while (!stack.empty()) {
+            int index = stack.back();
+            stack.pop_back();
+            const Node& node = nodes[index];
+            if (!overlaps(node.box)) continue;
+            if (node.isLeaf()) {
+                if (!fn(index)) return;
+            } else {
+                stack.push_back(node.child1);
+                stack.push_back(node.child2);
+            }
+        }
+    }
+
+    int allocateNode() {
+        if (freeList != Null) {
+            int index = freeList;
+            freeList = nodes[index].parent;
+            nodes[index] = Node();
+            return index;
+        }
+        nodes.emplace_back();
+        return static_cast<int>(nodes.size() - 1);
+    }
+
+    void freeNode(int index) {
+        nodes[index] = Node();
+        nodes[index].parent = freeList;
+        freeList = index;
+    }
+
+    void insertLeaf(int leaf) {
+        if (root == Null) {
+            root = leaf;
+            nodes[root].parent = Null;
+            return;
+        }
+
+        // Descend towards the sibling that grows the total surface area least.
+        const BoundingBox leafBox = nodes[leaf].box;
+        int index = root;
+        while (!nodes[index].isLeaf()) {
+            const Node& node = nodes[index];
+            float nodeArea = area(node.box);
+            float combinedArea = area(merged(node.box, leafBox));
+            float cost = 2.0f * combinedArea;
+            float inheritance = 2.0f * (combinedArea - nodeArea);
+            auto descendCost = [&](int child) {
+                float grown = area(merged(leafBox, nodes[child].box));
+                return nodes[child].isLeaf() ? grown + inheritance : grown - area(nodes[child].box) + inheritance;
+            };
+            float cost1 = descendCost(node.child1);
+            float cost2 = descendCost(node.child2);
+            if (cost < cost1 && cost < cost2) break;
+            index = cost1 < cost2 ? node.child1 : node.child2;
+        }
+
+        int sibling = index;
+        int oldParent = nodes[sibling].parent;
+        int newParent = allocateNode();
+        nodes[newParent].parent = oldParent;
+        nodes[newParent].box = merged(leafBox, nodes[sibling].box);
+        nodes[newParent].height = nodes[sibling].height + 1;
+        nodes[newParent].child1 = sibling;
+        nodes[newParent].child2 = leaf;
+        nodes[sibling].parent = newParent;
+        nodes[leaf].parent = newParent;
+        if (oldParent == Null) {
+            root = newParent;
+        } else if (nodes[oldParent].child1 == sibling) {
+            nodes[oldParent].child1 = newParent;
+        } else {
+            nodes[oldParent].child2 = newParent;
+        }
+        refit(nodes[leaf].parent);
+    }
+
+    void removeLeaf(int leaf) {
+        if (leaf == root) {
+            root = Null;
+            return;
+        }
+        int parent = nodes[leaf].parent;
+        int grandParent = nodes[parent].parent;
+        int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+        if (grandParent == Null) {
+            root = sibling;
+            nodes[sibling].parent = Null;
+        } else {
+            if (nodes[grandParent].child1 == parent) {
+                nodes[grandParent].child1 = sibling;
+            } else {
+                nodes[grandParent].child2 = sibling;
+            }
+            nodes[sibling].parent = grandParent;
+            refit(grandParent);
+        }
+        freeNode(parent);
+    }
+
+    // Walks to the root rebalancing and recomputing boxes and heights.
+    void refit(int index) {
+        while (index != Null) {
+            index = balance(index);
+            Node& node = nodes[index];
+            node.height = 1 + std::max(nodes[node.child1].height, nodes[node.child2].height);
+            node.box = merged(nodes[node.child1].box, nodes[node.child2].box);
+            index = node.parent;
+        }
+    }
+
+    // Rotates `a` if its children's heights differ by more than one and
+    // returns the index now at a's position.
+    int balance(int a) {
+        Node& A = nodes[a];
+        if (A.isLeaf() || A.height < 2) return a;
+        int b = A.child1, c = A.child2;
+        int diff = nodes[c].height - nodes[b].height;
+        if (diff > 1) return rotate(a, c, b);
+        if (diff < -1) return rotate(a, b, c);
+        return a;
+    }
+
+    // Promotes the taller child `up` above `a`; `other` is a's other child.
+    int rotate(int a, int up, int other) {
+        int f = nodes[up].child1, g = nodes[up].child2;
+        nodes[up].child1 = a;
+        nodes[up].parent = nodes[a].parent;
+        nodes[a].parent = up;
+        int p = nodes[up].parent;
+        if (p == Null) {
+            root = up;
+        } else if (nodes[p].child1 == a) {
+            nodes[p].child1 = up;
+        } else {
+            nodes[p].child2 = up;
+        }
+
+        // Keep the taller grandchild under `up`, hand the shorter one to `a`.
+        int keep = nodes[f].height > nodes[g].height ? f : g;
+        int give = keep == f ? g : f;
+        nodes[up].child2 = keep;
+        if (nodes[a].child1 == up) {
+            nodes[a].child1 = give;
+        } else {
+            nodes[a].child2 = give;
+        }
+        nodes[give].parent = a;
+        nodes[a].box = merged(nodes[other].box, nodes[give].box);
+        nodes[a].height = 1 + std::max(nodes[other].height, nodes[give].height);
+        nodes[up].box = merged(nodes[a].box, nodes[keep].box);
+        nodes[up].height = 1 + std::max(nodes[a].height, nodes[keep].height);
+        return up;
+    }
+};
+
+// Result of Scene::raycast and Scene::pick: the world-space point and face
+// normal of the nearest hit and the index of the triangle it landed on.
+struct RaycastHit {
+    EntityId entity;
+    float distance = 0.0f;
+    Vector3 point;
+    Vector3 normal;
+    int triangle = -1;
+};
+
+// Archetypes whose signature contains a required set. New archetypes are
+// picked up incrementally the next time the view is requested; entities move
+// between the cached archetypes as components are added and removed.
+struct ViewCache {
+    ComponentSignature required;
+    std::vector<Archetype*> archetypes;
+    size_t scanned = 0;
+
+    void refresh(const ArchetypeRegistry& registry) {
+        const auto& all = registry.all();
+        for (; scanned < all.size(); scanned++) {
+            if ((all[scanned]->signature & required) == required) {
+                archetypes.push_back(all[scanned]);
+            }
+        }
+    }
+};
+
+template<typename... T>
+class View {
+public:
+    explicit View(ViewCache* cache) : cache(cache) {}
+
+    // fn(Entity&, T&...) for every active entity of the scene that has all of T.
+    template<typename Fn>
+    void each(Fn&& fn) {
+        for (Archetype* archetype : cache->archetypes) {
+            eachIn(archetype, fn, std::index_sequence_for<T...>());
+        }
+    }
+
+    size_t size() const {
+        size_t count = 0;
+        for (Archetype* archetype : cache->archetypes) {
+            for (size_t row = 0; row < archetype->size(); row++) {
+                if (matches(archetype->entityAt(row))) count++;
             }
         }
-        
-        for (int ring = 0; ring < rings; ring++) {
-            for (int seg = 0; seg < segments; seg++) {
-                unsigned int curr = ring * (segments + 1) + seg;
-                unsigned int next = curr + segments + 1;
-                
-                mesh->addTriangle(curr, next, curr + 1);
-                mesh->addTriangle(curr + 1, next, next + 1);
+        return count;
+    }
+
+    std::vector<EntityId> ids() const {
+        std::vector<EntityId> result;
+        for (Archetype* archetype : cache->archetypes) {
+            for (size_t row = 0; row < archetype->size(); row++) {
+                Entity* entity = archetype->entityAt(row);
+                if (matches(entity)) result.push_back(entity->id);
             }
         }
-        
-        return mesh;
+        return result;
+    }
+
+private:
+    bool matches(const Entity* entity) const {
+        return entity->active;
+    }
+
+    template<typename Fn, size_t... I>
+    void eachIn(Archetype* archetype, Fn& fn, std::index_sequence<I...>) {
+        std::shared_ptr<Component>* columns[] = {
+            archetype->column(archetype->columnOf(componentTypeId<T>())).data()..., nullptr
+        };
+        size_t rows = archetype->size();
+        for (size_t row = 0; row < rows; row++) {
+            Entity* entity = archetype->entityAt(row);
+            if (!matches(entity)) continue;
+            fn(*entity, static_cast<T&>(*columns[I][row])...);
+        }
     }
+
+    ViewCache* cache;
 };
 
-class Camera {
+// Records structural changes (creating/destroying entities, adding/removing
+// components) so they can be made from inside an update or from worker
+// threads. Recording is thread-safe; everything is applied in one pass when
+// the scene reaches its sync point.
+class EntityCommandBuffer {
 public:
-    Vector3 position;
-    Vector3 rotation;
-    float fov = 60.0f;
-    float nearPlane = 0.1f;
-    float farPlane = 1000.0f;
-    Color clearColor;
-    
-    Camera() : position(0, 0, 3), clearColor(0.1f, 0.1f, 0.15f, 1.0f) {}
-    
-    Vector3 forward() const {
-        float pitch = rotation.x * 3.14159265f / 180.0f;
-        float yaw = rotation.y * 3.14159265f / 180.0f;
-        return Vector3(
-            std::sin(yaw) * std::cos(pitch),
-            -std::sin(pitch),
-            -std::cos(yaw) * std::cos(pitch)
-        );
+    using Command = std::function<void(Scene&)>;
+
+    template<typename T = Entity, typename... Args>
+    std::shared_ptr<T> create(Args&&... args) {
+        auto entity = std::make_shared<T>(std::forward<Args>(args)...);
+        addEntity(entity);
+        return entity;
     }
-    
-    Vector3 right() const {
-        float yaw = rotation.y * 3.14159265f / 180.0f;
-        return Vector3(std::cos(yaw), 0, std::sin(yaw));
+
+    void addEntity(std::shared_ptr<Entity> entity);
+    void addEntity(EntityId id);
+    void destroy(EntityId id);
+
+    template<typename T, typename... Args>
+    void addComponent(EntityId id, Args&&... args);
+
+    template<typename T>
+    void removeComponent(EntityId id);
+
+    // For entities recorded with create()/addEntity() that don't have an id yet.
+    template<typename T, typename... Args>
+    void addComponent(std::shared_ptr<Entity> entity, Args&&... args) {
+        record([entity, params = std::make_tuple(std::decay_t<Args>(std::forward<Args>(args))...)](Scene&) mutable {
+            std::apply([&entity](auto&&... a) { entity->addComponent<T>(std::move(a)...); }, std::move(params));
+        });
     }
-    
-    Vector3 up() const {
-        return Vector3::cross(right(), forward()).normalized();
+
+    void record(Command command) {
+        std::lock_guard<std::mutex> lock(mutex);
+        commands.push_back(std::move(command));
     }
-};
 
-struct Light {
-    enum class Type { Directional, Point, Spot };
-    
-    Type type = Type::Directional;
-    Vector3 position;
-    Vector3 direction;
-    Color color;
-    float intensity = 1.0f;
-    float range = 10.0f;
-    float spotAngle = 45.0f;
-    
-    Light() : direction(0, -1, 0), color(Color::white()) {}
+    // Commands recorded while applying run in the same pass.
+    void apply(Scene& scene) {
+        while (true) {
+            std::vector<Command> batch;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (commands.empty()) return;
+                batch.swap(commands);
+            }
+            for (auto& command : batch) {
+                command(scene);
+            }
+        }
+    }
+
+    void discard() {
+        std::lock_guard<std::mutex> lock(mutex);
+        commands.clear();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return commands.size();
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    mutable std::mutex mutex;
+    std::vector<Command> commands;
 };
 
 class Scene {
@@ -584,37 +2642,247 @@ public:
     std::vector<std::shared_ptr<Shader>> shaders;
     Camera camera;
     Color ambientColor;
+    EntityCommandBuffer commands;
+    std::vector<MeshRenderer*> renderables;
     
     Scene() : ambientColor(0.2f, 0.2f, 0.2f, 1.0f) {}
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
+    ~Scene() { clear(); }
+    
+    EntityId spawn(std::shared_ptr<Entity> entity) {
+        if (entity->scene == this) return entity->id;
+        if (entity->scene) entity->scene->removeEntity(entity->id);
+        entity->id = handles.insert(entity);
+        entity->scene = this;
+        return entity->id;
+    }
+    
+    // While the scene is updating, attaching and removing are deferred to
+    // the command buffer so the archetypes being iterated stay untouched.
+    // While systems run even the id is only assigned when the commands are
+    // applied, so this returns an invalid id then.
+    EntityId addEntity(std::shared_ptr<Entity> entity) {
+        if (runningSystems) {
+            commands.addEntity(entity);
+            return EntityId();
+        }
+        EntityId id = spawn(entity);
+        if (updating) commands.addEntity(id);
+        else attach(entity.get());
+        return id;
+    }
+    
+    EntityId addEntity(EntityId id) {
+        auto* slot = handles.get(id);
+        if (!slot) return EntityId();
+        // Hold the entity itself, in case its script handle is collected
+        // and releases it before the command runs.
+        if (updating) commands.addEntity(*slot);
+        else attach(slot->get());
+        return id;
+    }
+    
+    // Frees an entity that was spawned but never added, as when a script
+    // drops the handle a create* function gave it.
+    void releaseSpawned(EntityId id) {
+        auto* slot = handles.get(id);
+        if (!slot || (*slot)->isAttached()) return;
+        std::shared_ptr<Entity> entity = *slot;
+        handles.erase(id);
+        entity->id = EntityId();
+        entity->scene = nullptr;
+    }
     
-    void addEntity(std::shared_ptr<Entity> entity) {
-        entities.push_back(entity);
+    void removeEntity(EntityId id) {
+        if (updating) {
+            commands.destroy(id);
+            return;
+        }
+        auto* slot = handles.get(id);
+        if (!slot) return;
+        std::shared_ptr<Entity> entity = *slot;
+        detach(entity.get());
+        handles.erase(id);
+        entity->id = EntityId();
+        entity->scene = nullptr;
     }
     
     void removeEntity(std::shared_ptr<Entity> entity) {
-        entities.erase(std::remove(entities.begin(), entities.end(), entity), entities.end());
+        if (entity && entity->scene == this) removeEntity(entity->id);
     }
     
     void removeEntityByName(const std::string& name) {
-        entities.erase(std::remove_if(entities.begin(), entities.end(),
-            [&name](const std::shared_ptr<Entity>& e) { return e->name == name; }), entities.end());
+        std::vector<EntityId> matches;
+        auto range = nameIndex.equal_range(name);
+        for (auto it = range.first; it != range.second; ++it) {
+            matches.push_back(it->second);
+        }
+        for (EntityId id : matches) {
+            removeEntity(id);
+        }
     }
     
-    std::shared_ptr<Entity> getEntityByName(const std::string& name) {
-        for (auto& entity : entities) {
-            if (entity->name == name) return entity;
+    bool isValid(EntityId id) const { return handles.contains(id); }
+    
+    Entity* getEntity(EntityId id) {
+        auto* slot = handles.get(id);
+        return slot ? slot->get() : nullptr;
+    }
+    
+    template<typename T>
+    T* getEntity(EntityId id) {
+        return dynamic_cast<T*>(getEntity(id));
+    }
+    
+    std::shared_ptr<Entity> getEntityPtr(EntityId id) {
+        auto* slot = handles.get(id);
+        return slot ? *slot : nullptr;
+    }
+    
+    EntityId getEntityByName(const std::string& name) const {
+        auto it = nameIndex.find(name);
+        return it != nameIndex.end() ? it->second : EntityId();
+    }
+    
+    std::vector<EntityId> getEntitiesByTag(const std::string& tag) const {
+        std::vector<EntityId> result;
+        auto range = tagIndex.equal_range(tag);
+        for (auto it = range.first; it != range.second; ++it) {
+            result.push_back(it->second);
         }
-        return nullptr;
+        return result;
     }
     
-    std::vector<std::shared_ptr<Entity>> getEntitiesByTag(const std::string& tag) {
-        std::vector<std::shared_ptr<Entity>> result;
-        for (auto& entity : entities) {
-            if (entity->tag == tag) result.push_back(entity);
+    size_t countEntitiesWithTag(const std::string& tag) const {
+        return tagIndex.count(tag);
+    }
+    
+    // Visits every attached entity with the given tag without allocating.
+    // The callback must not add or remove entities.
+    template<typename Fn>
+    void forEachWithTag(const std::string& tag, Fn&& fn) {
+        auto range = tagIndex.equal_range(tag);
+        for (auto it = range.first; it != range.second; ++it) {
+            fn(*handles.get(it->second)->get());
+        }
+    }
+    
+    // Entities are visited by archetype, not in `entities` order. The callback
+    // must not add or remove entities or components; use `commands` for that.
+    template<typename... T>
+    View<T...> view() {
+        ComponentSignature required;
+        (required.set(componentTypeId<T>()), ...);
+        return View<T...>(&viewCache(required));
+    }
+    
+    // Script-facing query by registered component names; unknown names match
+    // nothing.
+    std::vector<EntityId> query(const std::vector<std::string>& componentNames) {
+        ComponentSignature required;
+        for (auto& name : componentNames) {
+            ComponentTypeId type;
+            if (!ComponentNames::instance().find(name, type)) return {};
+            required.set(type);
+        }
+        std::vector<EntityId> result;
+        for (Archetype* archetype : viewCache(required).archetypes) {
+            for (size_t row = 0; row < archetype->size(); row++) {
+                Entity* entity = archetype->entityAt(row);
+                if (entity->active) result.push_back(entity->id);
+            }
+        }
+        return result;
+    }
+    
+    // Spatial queries over drawable entities, answered from a BVH kept up to
+    // date by updateSpatialIndex(). Inactive entities are skipped.
+    std::vector<EntityId> queryBox(const BoundingBox& box) const {
+        std::vector<EntityId> result;
+        spatialIndex.query(box, [&](int proxy) {
+            const MeshRenderer* renderable = spatialIndex.payload(proxy);
+            if (renderable->entity->active && renderable->bounds.intersects(box)) {
+                result.push_back(renderable->entity->id);
+            }
+            return true;
+        });
+        return result;
+    }
+    
+    std::vector<EntityId> querySphere(const Vector3& center, float radius) const {
+        std::vector<EntityId> result;
+        Vector3 extent(radius, radius, radius);
+        spatialIndex.query(BoundingBox(center - extent, center + extent), [&](int proxy) {
+            const MeshRenderer* renderable = spatialIndex.payload(proxy);
+            if (renderable->entity->active && DynamicBVH<MeshRenderer*>::boxDistance(center, renderable->bounds) <= radius) {
+                result.push_back(renderable->entity->id);
+            }
+            return true;
+        });
+        return result;
+    }
+    
+    // Up to k entities ordered by the distance from `point` to their bounds.
+    std::vector<EntityId> nearest(const Vector3& point, size_t k, float maxDistance = std::numeric_limits<float>::infinity()) const {
+        auto found = spatialIndex.nearest(point, k, maxDistance, [&](int proxy) {
+            const MeshRenderer* renderable = spatialIndex.payload(proxy);
+            if (!renderable->entity->active) return std::numeric_limits<float>::infinity();
+            return DynamicBVH<MeshRenderer*>::boxDistance(point, renderable->bounds);
+        });
+        std::vector<EntityId> result;
+        result.reserve(found.size());
+        for (auto& [distance, proxy] : found) {
+            result.push_back(spatialIndex.payload(proxy)->entity->id);
         }
         return result;
     }
     
+    // Closest triangle the ray hits within maxDistance. Only entities whose
+    // bounds the ray enters before the current best hit have their triangles
+    // tested, with the ray taken into the mesh's local space.
+    bool raycast(const Vector3& origin, const Vector3& direction, RaycastHit& hit,
+                 float maxDistance = std::numeric_limits<float>::infinity()) const {
+        Vector3 dir = direction.normalized();
+        Vector3 inv(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+        bool found = false;
+        spatialIndex.raycast(origin, dir, maxDistance, [&](int proxy, float limit) {
+            const MeshRenderer* renderable = spatialIndex.payload(proxy);
+            float entry;
+            if (!renderable->entity->active || !renderable->mesh ||
+                !DynamicBVH<MeshRenderer*>::rayBox(origin, inv, renderable->bounds, limit, entry)) {
+                return limit;
+            }
+            Matrix4 toLocal = renderable->entity->transform.worldMatrix().affineInverse();
+            const TrianglePackets& triangles = renderable->mesh->geometry()->triangles();
+            float distance;
+            int triangle;
+            if (!triangles.raycast(toLocal.transformPoint(origin), toLocal.transformDirection(dir), limit, distance, triangle)) {
+                return limit;
+            }
+            Vector3 normal = toLocal.transformTransposed(triangles.normal(triangle)).normalized();
+            found = true;
+            hit.entity = renderable->entity->id;
+            hit.distance = distance;
+            hit.point = origin + dir * distance;
+            hit.normal = Vector3::dot(normal, dir) > 0.0f ? normal * -1.0f : normal;
+            hit.triangle = triangle;
+            return distance;
+        });
+        return found;
+    }
+
+    // Entity under a point in window coordinates, such as
+    // Input::getMousePosition(), seen through the scene camera.
+    bool pick(float screenX, float screenY, float viewportWidth, float viewportHeight, RaycastHit& hit) const {
+        if (viewportWidth <= 0.0f || viewportHeight <= 0.0f) return false;
+        Vector3 origin, direction;
+        float length = camera.screenRay(screenX, screenY, viewportWidth, viewportHeight, origin, direction);
+        return raycast(origin, direction, hit, length);
+    }
+    
+    const DynamicBVH<MeshRenderer*>& getSpatialIndex() const { return spatialIndex; }
+    
     void addLight(const Light& light) {
         lights.push_back(light);
     }
@@ -630,34 +2898,376 @@ public:
         return nullptr;
     }
     
+    // Structural changes made by components while these run (adding or
+    // removing entities or components) wait for applyCommands().
     void update(float deltaTime) {
-        for (auto& entity : entities) {
-            if (entity->active) {
-                entity->updateComponents(deltaTime);
-            }
+        updating = true;
+        const auto& all = archetypes.all();
+        for (size_t i = 0, count = all.size(); i < count; i++) {
+            all[i]->update(deltaTime);
         }
+        updating = false;
     }
     
     void lateUpdate(float deltaTime) {
+        updating = true;
+        const auto& all = archetypes.all();
+        for (size_t i = 0, count = all.size(); i < count; i++) {
+            all[i]->lateUpdate(deltaTime);
+        }
+        updating = false;
+    }
+    
+    void applyCommands() {
+        commands.apply(*this);
+    }
+    
+    // Moves changed drawables in the BVH. Run after updateTransforms().
+    void updateSpatialIndex() {
+        for (MeshRenderer* renderable : renderables) {
+            if (renderable->refreshBounds()) {
+                spatialIndex.move(renderable->proxy, renderable->bounds);
+            }
+        }
+    }
+    
+    // Breadth-first from the attached entities whose parent is not attached,
+    // so parents are always finished before their children.
+    void updateTransforms() {
+        transformQueue.clear();
         for (auto& entity : entities) {
-            if (entity->active) {
-                entity->lateUpdateComponents(deltaTime);
+            Transform* parent = entity->transform.getParent();
+            if (!parent || !parent->attached) transformQueue.push_back({&entity->transform, false});
+        }
+        for (size_t i = 0; i < transformQueue.size(); i++) {
+            auto [transform, parentChanged] = transformQueue[i];
+            bool changed = transform->updateWorld(parentChanged);
+            for (Transform* child : transform->getChildren()) {
+                transformQueue.push_back({child, changed});
             }
         }
     }
     
     void clear() {
+        commands.discard();
+        handles.forEach([](std::shared_ptr<Entity>& entity) {
+            entity->id = EntityId();
+            entity->scene = nullptr;
+            entity->sceneIndex = Entity::DetachedIndex;
+            entity->transform.attached = false;
+            entity->setRegistry(ArchetypeRegistry::detached());
+        });
+        for (MeshRenderer* renderable : renderables) {
+            renderable->renderIndex = MeshRenderer::Unregistered;
+            renderable->proxy = -1;
+        }
+        renderables.clear();
+        spatialIndex.clear();
+        handles.clear();
         entities.clear();
+        nameIndex.clear();
+        tagIndex.clear();
         lights.clear();
     }
+
+private:
+    friend class Entity;
+    friend class SystemScheduler;
+    using EntityIndex = std::unordered_multimap<std::string, EntityId>;
+
+    static void unindex(EntityIndex& index, const std::string& key, EntityId id) {
+        auto range = index.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == id) {
+                index.erase(it);
+                return;
+            }
+        }
+    }
+    
+    static void reindex(EntityIndex& index, Entity* entity, std::string& key, const std::string& value) {
+        if (key == value) return;
+        unindex(index, key, entity->id);
+        key = value;
+        index.emplace(key, entity->id);
+    }
+    
+    void attach(Entity* entity) {
+        if (entity->isAttached()) return;
+        entity->sceneIndex = entities.size();
+        entities.push_back(entity->shared_from_this());
+        nameIndex.emplace(entity->name, entity->id);
+        tagIndex.emplace(entity->tag, entity->id);
+        entity->setRegistry(archetypes);
+        entity->transform.attached = true;
+        if (auto renderer = entity->getComponent<MeshRenderer>()) addRenderable(renderer.get());
+    }
+    
+    void detach(Entity* entity) {
+        if (!entity->isAttached()) return;
+        unindex(nameIndex, entity->name, entity->id);
+        unindex(tagIndex, entity->tag, entity->id);
+        if (auto renderer = entity->getComponent<MeshRenderer>()) removeRenderable(renderer.get());
+        size_t index = entity->sceneIndex;
+        if (index != entities.size() - 1) {
+            entities[index] = std::move(entities.back());
+            entities[index]->sceneIndex = index;
+        }
+        entities.pop_back();
+        entity->sceneIndex = Entity::DetachedIndex;
+        entity->transform.attached = false;
+        entity->setRegistry(ArchetypeRegistry::detached());
+    }
+    
+    friend class MeshRenderer;
+
+    void addRenderable(MeshRenderer* renderable) {
+        if (renderable->renderIndex != MeshRenderer::Unregistered) return;
+        renderable->renderIndex = renderables.size();
+        renderables.push_back(renderable);
+        renderable->refreshBounds();
+        renderable->proxy = spatialIndex.insert(renderable->bounds, renderable);
+    }
+    
+    void removeRenderable(MeshRenderer* renderable) {
+        size_t index = renderable->renderIndex;
+        if (index == MeshRenderer::Unregistered) return;
+        renderables[index] = renderables.back();
+        renderables[index]->renderIndex = index;
+        renderables.pop_back();
+        renderable->renderIndex = MeshRenderer::Unregistered;
+        spatialIndex.remove(renderable->proxy);
+        renderable->proxy = -1;
+    }
+    
+    ViewCache& viewCache(const ComponentSignature& required) {
+        auto& cache = views[required];
+        if (!cache) {
+            cache = std::make_unique<ViewCache>();
+            cache->required = required;
+        }
+        cache->refresh(archetypes);
+        return *cache;
+    }
+    
+    SlotMap<std::shared_ptr<Entity>> handles;
+    EntityIndex nameIndex;
+    EntityIndex tagIndex;
+    ArchetypeRegistry archetypes;
+    std::unordered_map<ComponentSignature, std::unique_ptr<ViewCache>> views;
+    std::vector<std::pair<Transform*, bool>> transformQueue;
+    DynamicBVH<MeshRenderer*> spatialIndex;
+    bool updating = false;
+    bool runningSystems = false;
+};
+
+inline void MeshRenderer::onAttach() {
+    if (entity->isAttached()) entity->scene->addRenderable(this);
+}
+
+inline void MeshRenderer::onDetach() {
+    if (entity->isAttached()) entity->scene->removeRenderable(this);
+}
+
+inline void EntityCommandBuffer::addEntity(std::shared_ptr<Entity> entity) {
+    record([entity](Scene& scene) { scene.addEntity(entity); });
+}
+
+inline void EntityCommandBuffer::addEntity(EntityId id) {
+    record([id](Scene& scene) { scene.addEntity(id); });
+}
+
+inline void EntityCommandBuffer::destroy(EntityId id) {
+    record([id](Scene& scene) { scene.removeEntity(id); });
+}
+
+template<typename T, typename... Args>
+void EntityCommandBuffer::addComponent(EntityId id, Args&&... args) {
+    record([id, params = std::make_tuple(std::decay_t<Args>(std::forward<Args>(args))...)](Scene& scene) mutable {
+        if (Entity* entity = scene.getEntity(id)) {
+            std::apply([entity](auto&&... a) { entity->addComponent<T>(std::move(a)...); }, std::move(params));
+        }
+    });
+}
+
+template<typename T>
+void EntityCommandBuffer::removeComponent(EntityId id) {
+    record([id](Scene& scene) {
+        if (Entity* entity = scene.getEntity(id)) entity->removeComponent<T>();
+    });
+}
+
+inline bool Entity::deferring() const {
+    return scene && scene->updating;
+}
+
+inline void Entity::deferAttach(ComponentTypeId type, std::shared_ptr<Component> comp) {
+    scene->commands.record([id = id, type, comp](Scene& scene) {
+        if (Entity* entity = scene.getEntity(id)) entity->attachComponent(type, comp);
+    });
+}
+
+inline void Entity::deferDetach(ComponentTypeId type) {
+    scene->commands.record([id = id, type](Scene& scene) {
+        if (Entity* entity = scene.getEntity(id)) entity->detachComponent(type);
+    });
+}
+
+inline void Entity::setName(const std::string& value) {
+    if (isAttached()) Scene::reindex(scene->nameIndex, this, name, value);
+    else name = value;
+}
+
+inline void Entity::setTag(const std::string& value) {
+    if (isAttached()) Scene::reindex(scene->tagIndex, this, tag, value);
+    else tag = value;
+}
+
+// Per-frame logic that declares the component types it reads and writes, so
+// the scheduler can run systems that don't touch the same data concurrently.
+//
+// Systems may run on worker threads. While they do, Scene::addEntity and
+// removeEntity and Entity::addComponent and removeComponent on attached
+// entities only record commands, applied afterwards on the main thread.
+// Anything else that changes the scene's structure, including constructing
+// entities (a Mesh adds its MeshRenderer on construction), spawn(),
+// setName() and setTag(), must happen inside scene.commands.record().
+class System {
+public:
+    std::string name;
+    bool enabled = true;
+    ComponentSignature readSet;
+    ComponentSignature writeSet;
+
+    System(const std::string& name = "System") : name(name) {}
+    virtual ~System() = default;
+    virtual void update(Scene& scene, float deltaTime) = 0;
+
+    bool conflictsWith(const System& other) const {
+        return (writeSet & (other.readSet | other.writeSet)).any() ||
+               (other.writeSet & readSet).any();
+    }
+
+protected:
+    template<typename... T>
+    void reads() { (readSet.set(componentTypeId<T>()), ...); }
+
+    template<typename... T>
+    void writes() { (writeSet.set(componentTypeId<T>()), ...); }
+};
+
+// Runs systems in registration order as far as their declared access allows:
+// a system waits for every earlier system it conflicts with, everything else
+// runs in parallel on the job system.
+class SystemScheduler {
+public:
+    template<typename T, typename... Args>
+    T* addSystem(Args&&... args) {
+        auto system = std::make_unique<T>(std::forward<Args>(args)...);
+        T* ptr = system.get();
+        systems.push_back(std::move(system));
+        dirty = true;
+        return ptr;
+    }
+
+    void removeSystem(System* system) {
+        systems.erase(std::remove_if(systems.begin(), systems.end(),
+            [system](const std::unique_ptr<System>& s) { return s.get() == system; }), systems.end());
+        dirty = true;
+    }
+
+    System* getSystem(const std::string& name) {
+        for (auto& system : systems) {
+            if (system->name == name) return system.get();
+        }
+        return nullptr;
+    }
+
+    void run(Scene& scene, float deltaTime, JobSystem* jobs) {
+        if (systems.empty()) return;
+        bool updating = scene.updating;
+        scene.updating = scene.runningSystems = true;
+        runSystems(scene, deltaTime, jobs);
+        scene.updating = updating;
+        scene.runningSystems = false;
+    }
+
+private:
+    void runSystems(Scene& scene, float deltaTime, JobSystem* jobs) {
+        if (!jobs || jobs->workerCount() == 0) {
+            for (size_t i = 0; i < systems.size(); i++) {
+                execute(i, scene, deltaTime);
+            }
+            return;
+        }
+        if (dirty) {
+            buildGraph();
+        }
+        JobCounter frame;
+        for (size_t i = 0; i < systems.size(); i++) {
+            remaining[i].store(dependencyCount[i], std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < systems.size(); i++) {
+            if (dependencyCount[i] == 0) launch(i, scene, deltaTime, *jobs, frame);
+        }
+        jobs->wait(frame);
+    }
+
+    void buildGraph() {
+        size_t count = systems.size();
+        dependents.assign(count, {});
+        dependencyCount.assign(count, 0);
+        remaining.reset(new std::atomic<int>[count]);
+        for (size_t j = 0; j < count; j++) {
+            for (size_t i = 0; i < j; i++) {
+                if (systems[i]->conflictsWith(*systems[j])) {
+                    dependents[i].push_back(j);
+                    dependencyCount[j]++;
+                }
+            }
+        }
+        dirty = false;
+    }
+
+    void launch(size_t index, Scene& scene, float deltaTime, JobSystem& jobs, JobCounter& frame) {
+        jobs.schedule([this, index, &scene, deltaTime, &jobs, &frame] {
+            execute(index, scene, deltaTime);
+            for (size_t next : dependents[index]) {
+                if (remaining[next].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    launch(next, scene, deltaTime, jobs, frame);
+                }
+            }
+        }, &frame);
+    }
+
+    void execute(size_t index, Scene& scene, float deltaTime) {
+        System& system = *systems[index];
+        if (!system.enabled) return;
+        try {
+            system.update(scene, deltaTime);
+        } catch (const std::exception& e) {
+            std::cerr << "System " << system.name << " error: " << e.what() << std::endl;
+        }
+    }
+
+    std::vector<std::unique_ptr<System>> systems;
+    std::vector<std::vector<size_t>> dependents;
+    std::vector<int> dependencyCount;
+    std::unique_ptr<std::atomic<int>[]> remaining;
+    bool dirty = true;
 };
 
 class IRenderer {
 public:
     virtual ~IRenderer() = default;
     virtual bool initialize(int width, int height, const std::string& title) = 0;
-    virtual void beginFrame(const Camera& camera) = 0;
-    virtual void renderMesh(Mesh* mesh, const std::vector<Light>& lights, const Color& ambient) = 0;
+    virtual void beginFrame(const Camera& camera, const std::vector<Light>& lights, const Color& ambient) = 0;
+    virtual void renderMesh(const MeshRenderer& renderable) = 0;
+    virtual void renderMeshes(const std::vector<MeshRenderer*>& renderables) {
+        for (const MeshRenderer* renderable : renderables) {
+            renderMesh(*renderable);
+        }
+    }
     virtual void endFrame() = 0;
     virtual bool shouldClose() = 0;
     virtual void shutdown() = 0;
@@ -732,6 +3342,12 @@ private:
     int fpsFrameCount = 0;
 };
 
+// Renderables that passed and failed the frustum test in the last frame.
+struct CullingStats {
+    size_t visible = 0;
+    size_t culled = 0;
+};
+
 class Engine {
 public:
     using UpdateCallback = std::function<void(float)>;
@@ -749,11 +3365,24 @@ public:
         scriptEngines.push_back(std::move(se));
     }
     
+    // 0 picks one worker per hardware thread besides the main one. Takes
+    // effect on the next initialize().
+    void setWorkerCount(size_t count) { workerCount = count; }
+    
+    template<typename T, typename... Args>
+    T* addSystem(Args&&... args) {
+        return systems.addSystem<T>(std::forward<Args>(args)...);
+    }
+    
+    void removeSystem(System* system) { systems.removeSystem(system); }
+    System* getSystem(const std::string& name) { return systems.getSystem(name); }
+    
     bool initialize(int width, int height, const std::string& title) {
         if (!renderer || !renderer->initialize(width, height, title)) {
             return false;
         }
         
+        jobs = std::make_unique<JobSystem>(workerCount);
         scene = std::make_unique<Scene>();
         
         for (auto& se : scriptEngines) {
@@ -776,6 +3405,7 @@ public:
             float dt = Time::instance().getDeltaTime();
             
             scene->update(dt);
+            systems.run(*scene, dt, jobs.get());
             
             for (auto& callback : updateCallbacks) {
                 callback(dt);
@@ -791,14 +3421,30 @@ public:
                 callback(dt);
             }
             
-            renderer->beginFrame(scene->camera);
+            scene->applyCommands();
+            scene->updateTransforms();
+            scene->updateSpatialIndex();
             
-            for (auto& entity : scene->entities) {
-                if (!entity->active) continue;
-                if (auto mesh = dynamic_cast<Mesh*>(entity.get())) {
-                    renderer->renderMesh(mesh, scene->lights, scene->ambientColor);
+            renderer->beginFrame(scene->camera, scene->lights, scene->ambientColor);
+            
+            float aspect = static_cast<float>(renderer->getWidth()) / std::max(renderer->getHeight(), 1);
+            const Camera& camera = scene->camera;
+            Frustum frustum = Frustum::fromMatrix(camera.projectionMatrix(aspect) * camera.viewMatrix());
+            cullingStats = CullingStats();
+            visibleRenderables.clear();
+            for (MeshRenderer* renderable : scene->renderables) {
+                if (!renderable->enabled || !renderable->mesh || !renderable->entity->active) continue;
+                if (!frustum.intersects(renderable->worldBounds())) {
+                    cullingStats.culled++;
+                    continue;
+                }
+                if (renderable->mesh->lod) {
+                    renderable->selectLOD(camera.screenSize(renderable->worldBounds()));
                 }
+                visibleRenderables.push_back(renderable);
             }
+            cullingStats.visible = visibleRenderables.size();
+            renderer->renderMeshes(visibleRenderables);
             
             renderer->endFrame();
         }
@@ -809,6 +3455,7 @@ public:
             se->shutdown();
         }
         if (renderer) renderer->shutdown();
+        jobs.reset();
         running = false;
     }
     
@@ -816,6 +3463,15 @@ public:
     
     Scene* getScene() { return scene.get(); }
     IRenderer* getRenderer() { return renderer.get(); }
+    JobSystem* getJobSystem() { return jobs.get(); }
+    const CullingStats& getCullingStats() const { return cullingStats; }
+
+    // Scene::pick over the renderer's viewport.
+    bool pick(float screenX, float screenY, RaycastHit& hit) const {
+        if (!scene || !renderer) return false;
+        return scene->pick(screenX, screenY, static_cast<float>(renderer->getWidth()),
+                           static_cast<float>(renderer->getHeight()), hit);
+    }
     
     IScriptEngine* getScriptEngine(const std::string& extension = "") {
         if (scriptEngines.empty()) return nullptr;
@@ -857,8 +3513,13 @@ private:
     std::unique_ptr<IRenderer> renderer;
     std::vector<std::unique_ptr<IScriptEngine>> scriptEngines;
     std::unique_ptr<Scene> scene;
+    std::unique_ptr<JobSystem> jobs;
+    size_t workerCount = 0;
+    SystemScheduler systems;
     std::vector<UpdateCallback> updateCallbacks;
     std::vector<UpdateCallback> lateUpdateCallbacks;
+    std::vector<MeshRenderer*> visibleRenderables;
+    CullingStats cullingStats;
     bool running;
 };
 
@@ -0,0 +1,244 @@
+/*
+   Copyright 2025 NEOAPPS
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef COMBINE_JOB_SYSTEM_H
+#define COMBINE_JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+namespace Combine {
+
+class JobCounter;
+
+struct Job {
+    std::function<void()> fn;
+    JobCounter* counter = nullptr;
+};
+
+// Counts outstanding jobs. Jobs scheduled to depend on a counter are held here
+// and released once it drops to zero.
+class JobCounter {
+public:
+    bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+    int value() const { return pending.load(std::memory_order_acquire); }
+
+private:
+    friend class JobSystem;
+
+    void add(int n) { pending.fetch_add(n, std::memory_order_relaxed); }
+
+    std::vector<Job> release() {
+        std::vector<Job> ready;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            ready.swap(continuations);
+        }
+        return ready;
+    }
+
+    bool deferUntilDone(Job& job) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (done()) return false;
+        continuations.push_back(std::move(job));
+        return true;
+    }
+
+    std::atomic<int> pending{0};
+    std::mutex mutex;
+    std::vector<Job> continuations;
+};
+
+// Work-stealing pool. Each worker owns a deque it pushes to and pops from the
+// back of; idle workers steal from the front of the others. The thread that
+// created the pool gets slot 0 and runs jobs while it waits on a counter.
+class JobSystem {
+public:
+    explicit JobSystem(size_t workerCount = 0) {
+        if (workerCount == 0) {
+            unsigned hw = std::thread::hardware_concurrency();
+            workerCount = hw > 1 ? hw - 1 : 0;
+        }
+        queues.reserve(workerCount + 1);
+        for (size_t i = 0; i <= workerCount; i++) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        owner = this;
+        slot = 0;
+        for (size_t i = 1; i <= workerCount; i++) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (owner == this) owner = nullptr;
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    size_t workerCount() const { return workers.size(); }
+
+    void schedule(std::function<void()> fn, JobCounter* counter = nullptr) {
+        if (counter) counter->add(1);
+        push(Job{std::move(fn), counter});
+    }
+
+    // The job is queued only once `dependency` reaches zero.
+    void schedule(std::function<void()> fn, JobCounter* counter, JobCounter& dependency) {
+        if (counter) counter->add(1);
+        Job job{std::move(fn), counter};
+        if (!dependency.deferUntilDone(job)) {
+            push(std::move(job));
+        }
+    }
+
+    // Runs queued jobs on the calling thread until the counter drains.
+    void wait(JobCounter& counter) {
+        size_t self = currentSlot();
+        while (!counter.done()) {
+            Job job;
+            if (take(self, job)) {
+                run(job);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        // The last release() may still hold the lock; wait it out so the
+        // caller can destroy the counter as soon as we return.
+        std::lock_guard<std::mutex> lock(counter.mutex);
+    }
+
+    // Splits [begin, end) into batches of `grain` indices and calls fn(i) for
+    // each index, returning once every batch has run.
+    template<typename Fn>
+    void parallelFor(size_t begin, size_t end, size_t grain, Fn&& fn) {
+        if (begin >= end) return;
+        grain = std::max<size_t>(grain, 1);
+        if (workers.empty() || end - begin <= grain) {
+            for (size_t i = begin; i < end; i++) fn(i);
+            return;
+        }
+        JobCounter counter;
+        for (size_t start = begin; start < end; start += grain) {
+            size_t stop = std::min(start + grain, end);
+            schedule([&fn, start, stop] {
+                for (size_t i = start; i < stop; i++) fn(i);
+            }, &counter);
+        }
+        wait(counter);
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    size_t currentSlot() const { return owner == this ? slot : 0; }
+
+    void push(Job job) {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            queued++;
+        }
+        Queue& queue = *queues[currentSlot()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+    }
+
+    bool take(size_t self, Job& job) {
+        {
+            Queue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.jobs.empty()) {
+                job = std::move(own.jobs.back());
+                own.jobs.pop_back();
+                queued--;
+                return true;
+            }
+        }
+        for (size_t n = 1; n < queues.size(); n++) {
+            Queue& victim = *queues[(self + n) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty()) {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(Job& job) {
+        job.fn();
+        if (!job.counter) return;
+        for (auto& next : job.counter->release()) {
+            push(std::move(next));
+        }
+    }
+
+    void workerLoop(size_t index) {
+        owner = this;
+        slot = index;
+        while (true) {
+            Job job;
+            if (take(index, job)) {
+                run(job);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+            if (stopping) return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> queued{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    static thread_local JobSystem* owner;
+    static thread_local size_t slot;
+};
+
+inline thread_local JobSystem* JobSystem::owner = nullptr;
+inline thread_local size_t JobSystem::slot = 0;
+
+}
+
+#endif
@@ -0,0 +1,309 @@
+/*
+   Copyright 2025 NEOAPPS
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef COMBINE_MESH_OPTIMIZER_H
+#define COMBINE_MESH_OPTIMIZER_H
+
+#include "CombineEngine.h"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace Combine {
+
+// Average cache miss ratio (post-transform cache misses per triangle) of an
+// index buffer before and after MeshOptimizer::optimize. 3 is the worst
+// possible; well-ordered meshes get close to 0.5.
+struct MeshOptimizationStats {
+    float acmrBefore = 0.0f;
+    float acmrAfter = 0.0f;
+};
+
+// Reorders index and vertex buffers for the GPU without changing what is
+// drawn: triangles for the post-transform vertex cache (Tipsify, Sander et
+// al. 2007), then clusters of them front-to-back against overdraw, then
+// vertices in first-use order for vertex fetch.
+class MeshOptimizer {
+public:
+    static constexpr unsigned int DefaultCacheSize = 16;
+
+    // Runs all three passes on `geometry`. Callers editing a Mesh should go
+    // through the Mesh overload so the change is versioned.
+    static MeshOptimizationStats optimize(MeshData& geometry, unsigned int cacheSize = DefaultCacheSize) {
+        MeshOptimizationStats stats;
+        stats.acmrBefore = acmr(geometry.indices, geometry.vertices.size(), cacheSize);
+        if (geometry.indices.size() >= 3) {
+            optimizeVertexCache(geometry.indices, geometry.vertices.size(), cacheSize);
+            optimizeOverdraw(geometry.indices, geometry.vertices, cacheSize);
+            optimizeVertexFetch(geometry);
+        }
+        stats.acmrAfter = acmr(geometry.indices, geometry.vertices.size(), cacheSize);
+        return stats;
+    }
+
+    // Like Mesh::editGeometry, this drops the mesh's LOD chain; optimize
+    // before generating one.
+    static MeshOptimizationStats optimize(Mesh& mesh, unsigned int cacheSize = DefaultCacheSize) {
+        return optimize(mesh.editGeometry(), cacheSize);
+    }
+
+    // FIFO cache of cacheSize entries, which is how most GPUs behave.
+    static float acmr(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = DefaultCacheSize) {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0) return 0.0f;
+        FifoCache cache(vertexCount, cacheSize);
+        size_t misses = 0;
+        for (size_t i = 0; i < triangleCount * 3; i++) {
+            misses += cache.touch(indices[i]);
+        }
+        return static_cast<float>(misses) / static_cast<float>(triangleCount);
+    }
+
+    // Tipsify: fans around one vertex at a time, moving next to a recently
+    // used vertex that will still be cached afterwards, or back along the
+    // dead-end stack when there is none. Linear in the triangle count.
+    static void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = DefaultCacheSize) {
+        size_t triangleCount = indices.size() / 3;
+        std::vector<unsigned int> offsets, adjacency;
+        buildAdjacency(indices, vertexCount, offsets, adjacency);
+
+        std::vector<unsigned int> live(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++) live[v] = offsets[v + 1] - offsets[v];
+        std::vector<size_t> cacheTime(vertexCount, 0);
+        std::vector<char> emitted(triangleCount, 0);
+        std::vector<unsigned int> deadEnd, candidates, result;
+        result.reserve(indices.size());
+        size_t time = cacheSize + 1;
+        size_t cursor = 0;
+
+        long fanning = skipDeadEnd(live, deadEnd, cursor);
+        while (fanning >= 0) {
+            candidates.clear();
+            for (unsigned int i = offsets[fanning]; i < offsets[fanning + 1]; i++) {
+                unsigned int t = adjacency[i];
+                if (emitted[t]) continue;
+                emitted[t] = 1;
+                for (int k = 0; k < 3; k++) {
+                    unsigned int v = indices[t * 3 + k];
+                    result.push_back(v);
+                    deadEnd.push_back(v);
+                    candidates.push_back(v);
+                    live[v]--;
+                    if (time - cacheTime[v] > cacheSize) cacheTime[v] = time++;
+                }
+            }
+
+            long next = -1;
+            long bestPriority = -1;
+            for (unsigned int v : candidates) {
+                if (live[v] == 0) continue;
+                long priority = 0;
+                if (time - cacheTime[v] + 2 * live[v] <= cacheSize) priority = static_cast<long>(time - cacheTime[v]);
+                if (priority > bestPriority) {
+                    bestPriority = priority;
+                    next = v;
+                }
+            }
+            fanning = next >= 0 ? next : skipDeadEnd(live, deadEnd, cursor);
+        }
+
+        // Triangles referencing vertices past the end keep their place at the back.
+        for (size_t t = 0; t < triangleCount; t++) {
+            if (!emitted[t]) result.insert(result.end(), {indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2]});
+        }
+        indices.swap(result);
+    }
+
+    // Splits a cache-optimized index buffer into clusters wherever the cache
+    // starts over, and further wherever a cluster's own ACMR is within
+    // `threshold` of its parent's, then draws outward-facing clusters on
+    // the outside of the mesh first so that early depth testing rejects
+    // more of the rest.
+    static void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices,
+                                 unsigned int cacheSize = DefaultCacheSize, float threshold = 1.05f) {
+        size_t triangleCount = indices.size() / 3;
+        for (unsigned int index : indices) {
+            if (index >= vertices.size()) return;
+        }
+        std::vector<size_t> clusters = softBoundaries(indices, vertices.size(), hardBoundaries(indices, vertices.size(), cacheSize),
+                                                      cacheSize, threshold);
+        if (clusters.size() < 2) return;
+
+        Vector3 meshCentroid;
+        float meshArea = 0.0f;
+        std::vector<Vector3> centroids(clusters.size()), normals(clusters.size());
+        for (size_t c = 0; c < clusters.size(); c++) {
+            size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+            float area = 0.0f;
+            for (size_t t = clusters[c]; t < end; t++) {
+                const Vector3& a = vertices[indices[t * 3]].position;
+                const Vector3& b = vertices[indices[t * 3 + 1]].position;
+                const Vector3& d = vertices[indices[t * 3 + 2]].position;
+                Vector3 cross = Vector3::cross(b - a, d - a);
+                float weight = cross.length();
+                centroids[c] += (a + b + d) * (weight / 3.0f);
+                normals[c] += cross;
+                area += weight;
+            }
+            meshCentroid += centroids[c];
+            meshArea += area;
+            centroids[c] = area > 0.0f ? centroids[c] * (1.0f / area) : vertices[indices[clusters[c] * 3]].position;
+        }
+        if (meshArea > 0.0f) meshCentroid = meshCentroid * (1.0f / meshArea);
+
+        std::vector<float> keys(clusters.size());
+        std::vector<size_t> order(clusters.size());
+        for (size_t c = 0; c < clusters.size(); c++) {
+            keys[c] = Vector3::dot(centroids[c] - meshCentroid, normals[c].normalized());
+            order[c] = c;
+        }
+        std::stable_sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] > keys[b]; });
+
+        std::vector<unsigned int> result;
+        result.reserve(indices.size());
+        for (size_t c : order) {
+            size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+            result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + end * 3);
+        }
+        result.insert(result.end(), indices.begin() + triangleCount * 3, indices.end());
+        indices.swap(result);
+    }
+
+    // Renumbers vertices in the order the index buffer first uses them.
+    // Unreferenced vertices keep their relative order at the end.
+    static void optimizeVertexFetch(MeshData& geometry) {
+        const unsigned int unassigned = std::numeric_limits<unsigned int>::max();
+        std::vector<unsigned int> remap(geometry.vertices.size(), unassigned);
+        std::vector<Vertex> vertices;
+        vertices.reserve(geometry.vertices.size());
+        for (unsigned int& index : geometry.indices) {
+            if (index >= remap.size()) continue;
+            if (remap[index] == unassigned) {
+                remap[index] = static_cast<unsigned int>(vertices.size());
+                vertices.push_back(geometry.vertices[index]);
+            }
+            index = remap[index];
+        }
+        for (size_t v = 0; v < geometry.vertices.size(); v++) {
+            if (remap[v] == unassigned) vertices.push_back(geometry.vertices[v]);
+        }
+        geometry.vertices.swap(vertices);
+    }
+
+private:
+    // Vertex `v` is cached while fewer than cacheSize misses have happened
+    // since it was loaded. flush() ages everything out at once.
+    struct FifoCache {
+        std::vector<size_t> loaded;
+        size_t clock;
+        unsigned int size;
+
+        FifoCache(size_t vertexCount, unsigned int cacheSize)
+            : loaded(vertexCount, 0), clock(cacheSize), size(cacheSize) {}
+
+        // Returns 1 on a miss.
+        int touch(unsigned int v) {
+            if (v >= loaded.size()) return 1;
+            if (clock - loaded[v] < size) return 0;
+            loaded[v] = clock++;
+            return 1;
+        }
+
+        void flush() { clock += size; }
+    };
+
+    static void buildAdjacency(const std::vector<unsigned int>& indices, size_t vertexCount,
+                               std::vector<unsigned int>& offsets, std::vector<unsigned int>& adjacency) {
+        size_t triangleCount = indices.size() / 3;
+        auto valid = [&](size_t t) {
+            return indices[t * 3] < vertexCount && indices[t * 3 + 1] < vertexCount && indices[t * 3 + 2] < vertexCount;
+        };
+        offsets.assign(vertexCount + 1, 0);
+        for (size_t t = 0; t < triangleCount; t++) {
+            if (!valid(t)) continue;
+            for (int k = 0; k < 3; k++) offsets[indices[t * 3 + k] + 1]++;
+        }
+        for (size_t v = 0; v < vertexCount; v++) offsets[v + 1] += offsets[v];
+        adjacency.resize(offsets[vertexCount]);
+        std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++) {
+            if (!valid(t)) continue;
+            for (int k = 0; k < 3; k++) adjacency[fill[indices[t * 3 + k]]++] = static_cast<unsigned int>(t);
+        }
+    }
+
+    // Most recently emitted vertex that still has triangles left, or else
+    // the next such vertex in index order; -1 once everything is emitted.
+    static long skipDeadEnd(const std::vector<unsigned int>& live, std::vector<unsigned int>& deadEnd, size_t& cursor) {
+        while (!deadEnd.empty()) {
+            unsigned int v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v] > 0) return v;
+        }
+        for (; cursor < live.size(); cursor++) {
+            if (live[cursor] > 0) return static_cast<long>(cursor);
+        }
+        return -1;
+    }
+
+    // First triangle of every run that starts with three cache misses.
+    static std::vector<size_t> hardBoundaries(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize) {
+        std::vector<size_t> boundaries;
+        FifoCache cache(vertexCount, cacheSize);
+        for (size_t t = 0; t < indices.size() / 3; t++) {
+            int misses = cache.touch(indices[t * 3]) + cache.touch(indices[t * 3 + 1]) + cache.touch(indices[t * 3 + 2]);
+            if (t == 0 || misses == 3) boundaries.push_back(t);
+        }
+        return boundaries;
+    }
+
+    // Splits each hard cluster once the run since the last split has an ACMR
+    // within `threshold` of the whole cluster's, assuming the cache starts
+    // cold at every split since clusters get reordered.
+    static std::vector<size_t> softBoundaries(const std::vector<unsigned int>& indices, size_t vertexCount,
+                                              const std::vector<size_t>& hard, unsigned int cacheSize, float threshold) {
+        size_t triangleCount = indices.size() / 3;
+        std::vector<size_t> boundaries;
+        FifoCache cache(vertexCount, cacheSize);
+        for (size_t h = 0; h < hard.size(); h++) {
+            size_t begin = hard[h];
+            size_t end = h + 1 < hard.size() ? hard[h + 1] : triangleCount;
+            cache.flush();
+            size_t clusterMisses = 0;
+            for (size_t i = begin * 3; i < end * 3; i++) clusterMisses += cache.touch(indices[i]);
+            float limit = threshold * static_cast<float>(clusterMisses) / static_cast<float>(end - begin);
+
+            cache.flush();
+            size_t start = begin, misses = 0;
+            boundaries.push_back(begin);
+            for (size_t t = begin; t < end; t++) {
+                misses += cache.touch(indices[t * 3]) + cache.touch(indices[t * 3 + 1]) + cache.touch(indices[t * 3 + 2]);
+                if (t + 1 < end && static_cast<float>(misses) <= limit * static_cast<float>(t + 1 - start)) {
+                    boundaries.push_back(t + 1);
+                    start = t + 1;
+                    misses = 0;
+                    cache.flush();
+                }
+            }
+        }
+        return boundaries;
+    }
+};
+
+}
+
+#endif
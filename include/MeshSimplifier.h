@@ -0,0 +1,376 @@
+/*
+   Copyright 2025 NEOAPPS
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef COMBINE_MESH_SIMPLIFIER_H
+#define COMBINE_MESH_SIMPLIFIER_H
+
+#include "CombineEngine.h"
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace Combine {
+
+// Quadric edge-collapse decimation (Garland-Heckbert). Every collapse moves a
+// vertex onto a neighbour, so the result only uses source vertices and keeps
+// their normals, UVs and colours untouched. Vertices split by a UV or normal
+// seam are never moved, open borders only slide along themselves, and
+// collapses that would turn a face by more than ~75 degrees are rejected.
+class MeshSimplifier {
+public:
+    // Simplifies `source` until at most targetRatio of its triangles remain
+    // or the next collapse would move the surface by more than maxError.
+    // Errors are fractions of the bounding-sphere radius; the largest one
+    // accepted is written to resultError.
+    static std::shared_ptr<MeshData> simplify(const MeshData& source, float targetRatio,
+                                              float maxError = std::numeric_limits<float>::infinity(),
+                                              float* resultError = nullptr) {
+        auto result = std::make_shared<MeshData>();
+        result->format = source.format;
+        if (resultError) *resultError = 0.0f;
+
+        std::vector<Vertex> vertices;
+        std::vector<unsigned int> indices;
+        weld(source, vertices, indices);
+        size_t vertexCount = vertices.size();
+        float radius = source.boundingSphere().radius;
+
+        size_t targetIndexCount = static_cast<size_t>(std::max(targetRatio, 0.0f) * (indices.size() / 3)) * 3;
+        double errorLimit = std::isinf(maxError) ? std::numeric_limits<double>::infinity()
+                                                 : static_cast<double>(maxError) * radius * maxError * radius;
+
+        std::vector<unsigned int> group = positionGroups(vertices);
+        std::vector<Kind> kinds = classify(vertices, indices, group);
+        std::vector<Quadric> quadrics = buildQuadrics(vertices, indices, group);
+
+        std::vector<unsigned int> collapse(vertexCount);
+        std::vector<char> touched(vertexCount);
+        std::vector<unsigned int> target(vertexCount);
+        std::vector<double> cost(vertexCount);
+        std::vector<unsigned int> order;
+        std::vector<unsigned int> adjacencyOffsets, adjacency;
+        double worstError = 0.0;
+
+        while (indices.size() > targetIndexCount) {
+            buildAdjacency(indices, vertexCount, adjacencyOffsets, adjacency);
+            std::fill(cost.begin(), cost.end(), std::numeric_limits<double>::infinity());
+            for (size_t t = 0; t < indices.size(); t += 3) {
+                for (int e = 0; e < 3; e++) {
+                    unsigned int a = indices[t + e], b = indices[t + (e + 1) % 3];
+                    considerCollapse(a, b, vertices, kinds, group, quadrics, adjacencyOffsets, adjacency, indices, target, cost);
+                    considerCollapse(b, a, vertices, kinds, group, quadrics, adjacencyOffsets, adjacency, indices, target, cost);
+                }
+            }
+            order.clear();
+            for (unsigned int v = 0; v < vertexCount; v++) {
+                if (std::isfinite(cost[v]) && cost[v] <= errorLimit) order.push_back(v);
+            }
+            std::sort(order.begin(), order.end(), [&cost](unsigned int a, unsigned int b) { return cost[a] < cost[b]; });
+
+            for (unsigned int v = 0; v < vertexCount; v++) collapse[v] = v;
+            std::fill(touched.begin(), touched.end(), 0);
+            size_t goal = (indices.size() - targetIndexCount) / 3;
+            size_t removed = 0, collapses = 0;
+            for (unsigned int from : order) {
+                unsigned int to = target[from];
+                if (touched[from] || touched[to]) continue;
+                if (flips(from, to, vertices, group, adjacencyOffsets, adjacency, indices)) continue;
+                collapse[from] = to;
+                quadrics[to].add(quadrics[from]);
+                for (unsigned int i = adjacencyOffsets[from]; i < adjacencyOffsets[from + 1]; i++) {
+                    const unsigned int* tri = &indices[adjacency[i] * 3];
+                    touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+                }
+                touched[to] = 1;
+                worstError = std::max(worstError, cost[from]);
+                collapses++;
+                removed += kinds[from] == Kind::Border ? 1 : 2;
+                if (removed >= goal) break;
+            }
+            if (collapses == 0) break;
+
+            size_t write = 0;
+            for (size_t t = 0; t < indices.size(); t += 3) {
+                unsigned int a = collapse[indices[t]], b = collapse[indices[t + 1]], c = collapse[indices[t + 2]];
+                if (group[a] == group[b] || group[b] == group[c] || group[a] == group[c]) continue;
+                indices[write++] = a;
+                indices[write++] = b;
+                indices[write++] = c;
+            }
+            indices.resize(write);
+        }
+
+        std::vector<unsigned int> remap(vertexCount, std::numeric_limits<unsigned int>::max());
+        for (unsigned int index : indices) {
+            if (remap[index] == std::numeric_limits<unsigned int>::max()) {
+                remap[index] = static_cast<unsigned int>(result->vertices.size());
+                result->vertices.push_back(vertices[index]);
+            }
+        }
+        result->indices.reserve(indices.size());
+        for (unsigned int index : indices) {
+            result->indices.push_back(remap[index]);
+        }
+        // Collapses leave the triangle order scattered, so reorder for the GPU.
+        MeshOptimizer::optimize(*result);
+        if (resultError && radius > 0.0f) *resultError = static_cast<float>(std::sqrt(worstError)) / radius;
+        return result;
+    }
+
+    static std::shared_ptr<MeshData> simplify(const Mesh& mesh, float targetRatio,
+                                              float maxError = std::numeric_limits<float>::infinity(),
+                                              float* resultError = nullptr) {
+        return simplify(*mesh.geometry(), targetRatio, maxError, resultError);
+    }
+
+    // A chain of up to levelCount levels, each `ratio` the triangles of the
+    // one before, starting from `source` itself. A level hands over to the
+    // next coarser one once that one's error drops below
+    // LODGroup::ScreenError of the screen height.
+    static std::shared_ptr<LODGroup> generateLODs(const std::shared_ptr<const MeshData>& source, int levelCount = 4, float ratio = 0.5f) {
+        auto group = std::make_shared<LODGroup>();
+        if (!source) return group;
+        std::vector<std::shared_ptr<const MeshData>> levels{source};
+        std::vector<float> errors{0.0f};
+        while (static_cast<int>(levels.size()) < levelCount) {
+            const MeshData& previous = *levels.back();
+            float stepError = 0.0f;
+            auto next = simplify(previous, ratio, std::numeric_limits<float>::infinity(), &stepError);
+            if (next->indices.empty() || next->indices.size() * 10 > previous.indices.size() * 9) break;
+            levels.push_back(next);
+            errors.push_back(errors.back() + stepError);
+        }
+        for (size_t i = 0; i < levels.size(); i++) {
+            // Errors are relative to the radius; on screen they scale with
+            // the diameter, which is what screenSize measures.
+            float screenSize = 0.0f;
+            if (i + 1 < levels.size()) {
+                screenSize = errors[i + 1] > 0.0f ? 2.0f * LODGroup::ScreenError / errors[i + 1]
+                                                  : std::numeric_limits<float>::max();
+            }
+            group->addLevel(levels[i], screenSize);
+        }
+        return group;
+    }
+
+private:
+    enum class Kind : uint8_t { Manifold, Border, Locked };
+
+    // Area-weighted sum of squared plane distances, divided by the total
+    // weight when evaluated so errors come out as squared distances.
+    struct Quadric {
+        double a00 = 0, a11 = 0, a22 = 0, a01 = 0, a02 = 0, a12 = 0;
+        double b0 = 0, b1 = 0, b2 = 0, c = 0, weight = 0;
+
+        void addPlane(const Vector3& n, double d, double w) {
+            a00 += w * n.x * n.x; a11 += w * n.y * n.y; a22 += w * n.z * n.z;
+            a01 += w * n.x * n.y; a02 += w * n.x * n.z; a12 += w * n.y * n.z;
+            b0 += w * n.x * d; b1 += w * n.y * d; b2 += w * n.z * d;
+            c += w * d * d;
+            weight += w;
+        }
+
+        void add(const Quadric& q) {
+            a00 += q.a00; a11 += q.a11; a22 += q.a22; a01 += q.a01; a02 += q.a02; a12 += q.a12;
+            b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c;
+            weight += q.weight;
+        }
+
+        double evaluate(const Vector3& p) const {
+            double x = p.x, y = p.y, z = p.z;
+            double e = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                       2.0 * (b0 * x + b1 * y + b2 * z) + c;
+            return weight > 0 ? std::fabs(e) / weight : 0.0;
+        }
+    };
+
+    // Border planes are weighted up so open edges hold their shape.
+    static constexpr double BorderWeight = 10.0;
+
+    static uint64_t edgeKey(unsigned int a, unsigned int b) {
+        if (a > b) std::swap(a, b);
+        return (static_cast<uint64_t>(a) << 32) | b;
+    }
+
+    // Merges vertices that are identical in every attribute and gives
+    // unindexed meshes an index buffer.
+    static void weld(const MeshData& source, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+        std::map<std::array<float, 12>, unsigned int> unique;
+        std::vector<unsigned int> remap(source.vertices.size());
+        for (size_t i = 0; i < source.vertices.size(); i++) {
+            const Vertex& v = source.vertices[i];
+            std::array<float, 12> key = {v.position.x, v.position.y, v.position.z, v.normal.x, v.normal.y, v.normal.z,
+                                         v.texCoord.x, v.texCoord.y, v.color.r, v.color.g, v.color.b, v.color.a};
+            auto inserted = unique.emplace(key, static_cast<unsigned int>(vertices.size()));
+            if (inserted.second) vertices.push_back(v);
+            remap[i] = inserted.first->second;
+        }
+        size_t count = source.indices.empty() ? source.vertices.size() : source.indices.size();
+        for (size_t t = 0; t + 2 < count; t += 3) {
+            size_t i[3];
+            for (int k = 0; k < 3; k++) {
+                i[k] = source.indices.empty() ? t + k : source.indices[t + k];
+            }
+            if (i[0] >= remap.size() || i[1] >= remap.size() || i[2] >= remap.size()) continue;
+            indices.insert(indices.end(), {remap[i[0]], remap[i[1]], remap[i[2]]});
+        }
+    }
+
+    // For every vertex, the first vertex sharing its position.
+    static std::vector<unsigned int> positionGroups(const std::vector<Vertex>& vertices) {
+        std::map<std::array<float, 3>, unsigned int> first;
+        std::vector<unsigned int> group(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++) {
+            const Vector3& p = vertices[i].position;
+            group[i] = first.emplace(std::array<float, 3>{p.x, p.y, p.z}, static_cast<unsigned int>(i)).first->second;
+        }
+        return group;
+    }
+
+    // Seam vertices (one position, several vertices), non-manifold edges
+    // and border corners are locked. Border vertices on a simple open
+    // boundary may slide along it.
+    static std::vector<Kind> classify(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+                                      const std::vector<unsigned int>& group) {
+        std::unordered_map<uint64_t, int> edges;
+        for (size_t t = 0; t < indices.size(); t += 3) {
+            for (int e = 0; e < 3; e++) {
+                edges[edgeKey(group[indices[t + e]], group[indices[t + (e + 1) % 3]])]++;
+            }
+        }
+        std::vector<int> groupSize(vertices.size()), borderEdges(vertices.size());
+        std::vector<char> nonManifold(vertices.size());
+        for (unsigned int g : group) groupSize[g]++;
+        for (auto& [key, count] : edges) {
+            unsigned int a = static_cast<unsigned int>(key >> 32), b = static_cast<unsigned int>(key & 0xffffffffu);
+            if (count == 1) {
+                borderEdges[a]++;
+                borderEdges[b]++;
+            } else if (count > 2) {
+                nonManifold[a] = nonManifold[b] = 1;
+            }
+        }
+        std::vector<Kind> kinds(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++) {
+            unsigned int g = group[i];
+            if (groupSize[g] > 1 || nonManifold[g]) kinds[i] = Kind::Locked;
+            else if (borderEdges[g] == 0) kinds[i] = Kind::Manifold;
+            else kinds[i] = borderEdges[g] == 2 ? Kind::Border : Kind::Locked;
+        }
+        return kinds;
+    }
+
+    static std::vector<Quadric> buildQuadrics(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+                                              const std::vector<unsigned int>& group) {
+        std::unordered_map<uint64_t, int> edges;
+        for (size_t t = 0; t < indices.size(); t += 3) {
+            for (int e = 0; e < 3; e++) {
+                edges[edgeKey(group[indices[t + e]], group[indices[t + (e + 1) % 3]])]++;
+            }
+        }
+        std::vector<Quadric> quadrics(vertices.size());
+        for (size_t t = 0; t < indices.size(); t += 3) {
+            const Vector3& p0 = vertices[indices[t]].position;
+            Vector3 cross = Vector3::cross(vertices[indices[t + 1]].position - p0, vertices[indices[t + 2]].position - p0);
+            float doubleArea = cross.length();
+            if (doubleArea <= 0.0f) continue;
+            Vector3 normal = cross * (1.0f / doubleArea);
+            for (int k = 0; k < 3; k++) {
+                quadrics[indices[t + k]].addPlane(normal, -Vector3::dot(normal, p0), doubleArea * 0.5);
+            }
+            for (int e = 0; e < 3; e++) {
+                unsigned int a = indices[t + e], b = indices[t + (e + 1) % 3];
+                if (edges[edgeKey(group[a], group[b])] != 1) continue;
+                Vector3 edge = vertices[b].position - vertices[a].position;
+                Vector3 side = Vector3::cross(edge, normal).normalized();
+                double w = BorderWeight * Vector3::dot(edge, edge);
+                double d = -Vector3::dot(side, vertices[a].position);
+                quadrics[a].addPlane(side, d, w);
+                quadrics[b].addPlane(side, d, w);
+            }
+        }
+        return quadrics;
+    }
+
+    // Triangles around each vertex, as offsets into `adjacency`.
+    static void buildAdjacency(const std::vector<unsigned int>& indices, size_t vertexCount,
+                               std::vector<unsigned int>& offsets, std::vector<unsigned int>& adjacency) {
+        offsets.assign(vertexCount + 1, 0);
+        for (unsigned int index : indices) offsets[index + 1]++;
+        for (size_t v = 0; v < vertexCount; v++) offsets[v + 1] += offsets[v];
+        adjacency.resize(indices.size());
+        std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) {
+            adjacency[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+        }
+    }
+
+    static bool isBorderEdge(unsigned int a, unsigned int b, const std::vector<unsigned int>& group,
+                             const std::vector<unsigned int>& offsets, const std::vector<unsigned int>& adjacency,
+                             const std::vector<unsigned int>& indices) {
+        int shared = 0;
+        for (unsigned int i = offsets[a]; i < offsets[a + 1]; i++) {
+            const unsigned int* tri = &indices[adjacency[i] * 3];
+            if (group[tri[0]] == group[b] || group[tri[1]] == group[b] || group[tri[2]] == group[b]) shared++;
+        }
+        return shared == 1;
+    }
+
+    static void considerCollapse(unsigned int from, unsigned int to, const std::vector<Vertex>& vertices,
+                                 const std::vector<Kind>& kinds, const std::vector<unsigned int>& group,
+                                 const std::vector<Quadric>& quadrics, const std::vector<unsigned int>& offsets,
+                                 const std::vector<unsigned int>& adjacency, const std::vector<unsigned int>& indices,
+                                 std::vector<unsigned int>& target, std::vector<double>& cost) {
+        if (kinds[from] == Kind::Locked) return;
+        if (kinds[from] == Kind::Border && !isBorderEdge(from, to, group, offsets, adjacency, indices)) return;
+        Quadric q = quadrics[from];
+        q.add(quadrics[to]);
+        double error = q.evaluate(vertices[to].position);
+        if (error < cost[from]) {
+            cost[from] = error;
+            target[from] = to;
+        }
+    }
+
+    static bool flips(unsigned int from, unsigned int to, const std::vector<Vertex>& vertices,
+                      const std::vector<unsigned int>& group, const std::vector<unsigned int>& offsets, const std::vector<unsigned int>& adjacency,
+                      const std::vector<unsigned int>& indices) {
+        for (unsigned int i = offsets[from]; i < offsets[from + 1]; i++) {
+            const unsigned int* tri = &indices[adjacency[i] * 3];
+            if (group[tri[0]] == group[to] || group[tri[1]] == group[to] || group[tri[2]] == group[to]) continue;
+            Vector3 p[3], q[3];
+            for (int k = 0; k < 3; k++) {
+                p[k] = vertices[tri[k]].position;
+                q[k] = tri[k] == from ? vertices[to].position : p[k];
+            }
+            Vector3 before = Vector3::cross(p[1] - p[0], p[2] - p[0]);
+            Vector3 after = Vector3::cross(q[1] - q[0], q[2] - q[0]);
+            if (Vector3::dot(before, after) <= 0.25f * before.length() * after.length()) return true;
+        }
+        return false;
+    }
+};
+
+}
+
+#endif
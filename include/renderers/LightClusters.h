@@ -0,0 +1,175 @@
+/*
+   Copyright 2025 NEOAPPS
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef COMBINE_LIGHT_CLUSTERS_H
+#define COMBINE_LIGHT_CLUSTERS_H
+
+#include "CombineEngine.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace Combine {
+
+// Bins lights into a view-frustum grid of GridX x GridY screen tiles and
+// GridZ exponential depth slices. Point and spot lights are added to every
+// cluster their range sphere touches. Directional lights reach everything,
+// so they go in a global list at the front of `indices` instead.
+//
+// The results are laid out for the shader's buffer textures:
+//   lightData - LightTexels RGBA texels per light
+//   grid      - (offset, count) into `indices` per cluster
+//   indices   - global light indices followed by the per-cluster lists
+class LightClusters {
+public:
+    static constexpr int GridX = 16;
+    static constexpr int GridY = 9;
+    static constexpr int GridZ = 24;
+    static constexpr int ClusterCount = GridX * GridY * GridZ;
+    static constexpr int LightTexels = 4;
+
+    std::vector<float> lightData;
+    std::vector<uint32_t> grid;
+    std::vector<uint32_t> indices;
+    int lightCount = 0;
+    int globalCount = 0;
+    float nearPlane = 0.1f;
+    float farPlane = 1000.0f;
+    float depthScale = 0.0f;
+
+    void build(const std::vector<Light>& lights, const glm::mat4& view, const glm::mat4& projection, float zNear, float zFar) {
+        nearPlane = zNear;
+        farPlane = zFar;
+        depthScale = GridZ / std::log(zFar / zNear);
+        lightCount = static_cast<int>(lights.size());
+        globalCount = 0;
+
+        lightData.resize(lights.size() * LightTexels * 4);
+        indices.clear();
+        ranges.clear();
+        for (size_t i = 0; i < lights.size(); i++) {
+            packLight(lights[i], &lightData[i * LightTexels * 4]);
+            if (lights[i].type == Light::Type::Directional) {
+                indices.push_back(static_cast<uint32_t>(i));
+                globalCount++;
+                continue;
+            }
+            Range range;
+            if (clusterRange(lights[i], view, projection, range)) {
+                range.light = static_cast<uint32_t>(i);
+                ranges.push_back(range);
+            }
+        }
+
+        counts.assign(ClusterCount, 0);
+        forEachCluster([this](const Range&, int cluster) { counts[cluster]++; });
+
+        grid.resize(ClusterCount * 2);
+        uint32_t offset = static_cast<uint32_t>(globalCount);
+        for (int c = 0; c < ClusterCount; c++) {
+            grid[c * 2] = offset;
+            grid[c * 2 + 1] = 0;
+            offset += counts[c];
+        }
+        indices.resize(offset);
+        forEachCluster([this](const Range& range, int cluster) {
+            uint32_t& count = grid[cluster * 2 + 1];
+            indices[grid[cluster * 2] + count++] = range.light;
+        });
+    }
+
+private:
+    struct Range {
+        uint32_t light = 0;
+        int x0 = 0, x1 = 0, y0 = 0, y1 = 0, z0 = 0, z1 = 0;
+    };
+
+    std::vector<Range> ranges;
+    std::vector<uint32_t> counts;
+
+    template<typename Fn>
+    void forEachCluster(Fn&& fn) {
+        for (const Range& range : ranges) {
+            for (int z = range.z0; z <= range.z1; z++) {
+                for (int y = range.y0; y <= range.y1; y++) {
+                    for (int x = range.x0; x <= range.x1; x++) {
+                        fn(range, (z * GridY + y) * GridX + x);
+                    }
+                }
+            }
+        }
+    }
+
+    static void packLight(const Light& light, float* out) {
+        Vector3 direction = light.direction.normalized();
+        const float texels[] = {
+            light.position.x, light.position.y, light.position.z, static_cast<float>(light.type),
+            direction.x, direction.y, direction.z, light.range,
+            light.color.r, light.color.g, light.color.b, light.color.a,
+            light.intensity, std::cos(light.spotAngle * 3.14159265f / 180.0f), 0.0f, 0.0f
+        };
+        std::copy(std::begin(texels), std::end(texels), out);
+    }
+
+    int slice(float depth) const {
+        int z = static_cast<int>(std::floor(std::log(depth / nearPlane) * depthScale));
+        return std::clamp(z, 0, GridZ - 1);
+    }
+
+    // Conservative cluster bounds of the light's range sphere. Returns false
+    // when the sphere is entirely outside the frustum.
+    bool clusterRange(const Light& light, const glm::mat4& view, const glm::mat4& projection, Range& range) const {
+        glm::vec3 center = glm::vec3(view * glm::vec4(light.position.x, light.position.y, light.position.z, 1.0f));
+        float radius = light.range;
+        float minDepth = -center.z - radius;
+        float maxDepth = -center.z + radius;
+        if (maxDepth < nearPlane || minDepth > farPlane) return false;
+
+        range.z0 = slice(std::max(minDepth, nearPlane));
+        range.z1 = slice(std::min(maxDepth, farPlane));
+        range.x0 = 0;
+        range.x1 = GridX - 1;
+        range.y0 = 0;
+        range.y1 = GridY - 1;
+        if (minDepth <= nearPlane) return true;
+
+        glm::vec2 lo(std::numeric_limits<float>::max()), hi(-std::numeric_limits<float>::max());
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec3 offset((corner & 1) ? radius : -radius, (corner & 2) ? radius : -radius, (corner & 4) ? radius : -radius);
+            glm::vec4 clip = projection * glm::vec4(center + offset, 1.0f);
+            glm::vec2 ndc = glm::vec2(clip) / clip.w;
+            lo = glm::min(lo, ndc);
+            hi = glm::max(hi, ndc);
+        }
+        if (hi.x < -1.0f || lo.x > 1.0f || hi.y < -1.0f || lo.y > 1.0f) return false;
+
+        auto tile = [](float ndc, int cells) {
+            return std::clamp(static_cast<int>((ndc * 0.5f + 0.5f) * cells), 0, cells - 1);
+        };
+        range.x0 = tile(lo.x, GridX);
+        range.x1 = tile(hi.x, GridX);
+        range.y0 = tile(lo.y, GridY);
+        range.y1 = tile(hi.y, GridY);
+        return true;
+    }
+};
+
+}
+
+#endif
@@ -17,6 +17,8 @@
 #ifndef OPENGL_RENDERER_H
 #define OPENGL_RENDERER_H
 #include "CombineEngine.h"
+#include "LightClusters.h"
+#include "StreamBuffer.h"
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
@@ -26,6 +28,7 @@
 #include <iostream>
 #include <vector>
 #include <fstream>
+#include <algorithm>
 #include <sstream>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -45,44 +48,108 @@ struct MeshBuffers {
     GLuint VAO = 0;
     GLuint VBO = 0;
     GLuint EBO = 0;
-    GLuint textureId = 0;
+    unsigned int version = 0;
+    VertexFormat format;
+    // format as uploaded, after VertexFormat::resolve.
+    VertexFormat layout;
     size_t vertexCount = 0;
     size_t indexCount = 0;
+    size_t vertexCapacity = 0;
+    size_t indexCapacity = 0;
+    GLenum indexType = GL_UNSIGNED_INT;
+    // Frame of the last content change. Geometry changing on consecutive
+    // frames is streamed: it is drawn from the renderer's StreamBuffer at
+    // baseVertex and indexOffset, for the frame it was written in only.
+    size_t updateFrame = 0;
+    size_t streamFrame = 0;
+    bool streamed = false;
+    GLint baseVertex = 0;
+    size_t indexOffset = 0;
 };
 
 class OpenGLRenderer : public IRenderer {
 private:
     GLFWwindow* window = nullptr;
     GLuint shaderProgram = 0;
+    GLuint activeProgram = 0;
     int windowWidth = 0;
     int windowHeight = 0;
     glm::mat4 projection;
     glm::mat4 view;
     bool wireframeMode = false;
     bool vsyncEnabled = true;
+    // Keyed by MeshData::id so meshes sharing geometry share one upload.
     std::unordered_map<unsigned int, MeshBuffers> meshBufferCache;
     std::unordered_map<std::string, Texture> textureCache;
     std::unordered_map<std::string, GLuint> shaderPrograms;
     struct UniformLocations {
         GLint model = -1, view = -1, projection = -1;
         GLint normalMatrix = -1, viewPos = -1, time = -1;
-        GLint meshColor = -1, ambientColor = -1;
+        GLint meshColor = -1;
         GLint uHasTexture = -1, uTextureSampler = -1;
-        GLint numLights = -1;
-        GLint lights[8][9];
+        GLint instanced = -1;
+        bool instancing = false;
     };
     std::unordered_map<GLuint, UniformLocations> uniformCache;
-    unsigned int nextMeshId = 1;
+
+    // std140 mirror of the `Lights` uniform block, uploaded once per frame
+    // and bound at LightBlockBinding for every program that declares it. The
+    // lights themselves and their cluster assignment live in buffer textures
+    // on units LightDataUnit and up; see LightClusters.
+    static constexpr GLuint LightBlockBinding = 0;
+    static constexpr GLint LightDataUnit = 1;
+    static constexpr GLint LightGridUnit = 2;
+    static constexpr GLint LightIndexUnit = 3;
+    struct LightBlock {
+        GLfloat ambientColor[4];
+        GLint clusterGrid[4];
+        GLint lightCounts[4];
+        GLfloat clusterDepth[4];
+        GLfloat screenSize[4];
+    };
+    static_assert(sizeof(LightBlock) == 80, "LightBlock must match std140 layout");
+    struct TextureBuffer {
+        GLuint buffer = 0;
+        GLuint texture = 0;
+    };
+    GLuint lightUBO = 0;
+    TextureBuffer lightDataBuffer, lightGridBuffer, lightIndexBuffer;
+    LightClusters lightClusters;
+
+    // Per-instance attributes: model matrix (locations 4-7), normal matrix
+    // (8-10) and color (11), sourced from one shared stream buffer.
+    static constexpr GLuint InstanceModelLocation = 4;
+    static constexpr GLuint InstanceNormalLocation = 8;
+    static constexpr GLuint InstanceColorLocation = 11;
+    static constexpr size_t InstanceFloats = 16 + 9 + 4;
+    struct BatchItem {
+        const MeshData* geometry;
+        GLuint texture;
+        const MeshRenderer* renderable;
+    };
+    GLuint instanceVBO = 0;
+    size_t instanceCapacity = 0;
+    std::vector<float> instanceData;
+    std::vector<BatchItem> batchItems;
+    std::vector<uint8_t> vertexData;
+    std::vector<uint16_t> indexData;
+    static constexpr size_t StreamBytesPerFrame = 8 << 20;
+    StreamBuffer streamBuffer;
+    size_t frameNumber = 0;
     const char* vertexShaderSource = R"(
         #version 330 core
         layout (location = 0) in vec3 aPos;
         layout (location = 1) in vec3 aNormal;
         layout (location = 2) in vec2 aTexCoord;
         layout (location = 3) in vec4 aColor;
+        layout (location = 4) in mat4 iModel;
+        layout (location = 8) in mat3 iNormalMatrix;
+        layout (location = 11) in vec4 iColor;
         uniform mat4 model;
         uniform mat4 view;
         uniform mat4 projection;
         uniform mat3 normalMatrix;
+        uniform bool uInstanced;
         uniform bool uHasTexture;
         uniform sampler2D uTextureSampler;
         out vec3 FragPos;
@@ -90,10 +157,16 @@ private:
         out vec2 TexCoord;
         out vec4 VertexColor;
         void main() {
-            FragPos = vec3(model * vec4(aPos, 1.0));
-            Normal = normalMatrix * aNormal;
+            if (uInstanced) {
+                FragPos = vec3(iModel * vec4(aPos, 1.0));
+                Normal = iNormalMatrix * aNormal;
+                VertexColor = aColor * iColor;
+            } else {
+                FragPos = vec3(model * vec4(aPos, 1.0));
+                Normal = normalMatrix * aNormal;
+                VertexColor = aColor;
+            }
             TexCoord = aTexCoord;
-            VertexColor = aColor;
             gl_Position = projection * view * vec4(FragPos, 1.0);
         }
     )";
@@ -107,7 +180,6 @@ private:
         out vec4 FragColor;
         uniform vec4 meshColor;
         uniform vec3 viewPos;
-        uniform vec4 ambientColor;
         uniform bool uHasTexture;
         uniform sampler2D uTextureSampler;
         struct Light {
@@ -117,54 +189,80 @@ private:
             vec4 color;
             float intensity;
             float range;
-            float spotAngle;
+            float spotCos;
         };
 
-        #define MAX_LIGHTS 8
-        uniform Light lights[MAX_LIGHTS];
-        uniform int numLights;
-        void main() {
-            vec3 norm = normalize(Normal);
-            vec3 viewDir = normalize(viewPos - FragPos);
-            vec3 ambient = ambientColor.rgb * ambientColor.a;
-            vec3 result = ambient;
-            for (int i = 0; i < numLights && i < MAX_LIGHTS; i++) {
-                vec3 lightDir;
-                float attenuation = 1.0;
-                if (lights[i].type == 0) {
-                    lightDir = normalize(-lights[i].direction);
-                } else if (lights[i].type == 1) {
-                    vec3 toLight = lights[i].position - FragPos;
-                    float dist = length(toLight);
-                    lightDir = normalize(toLight);
-                    attenuation = clamp(1.0 - dist / lights[i].range, 0.0, 1.0);
-                    attenuation *= attenuation;
-                } else {
-                    vec3 toLight = lights[i].position - FragPos;
-                    float dist = length(toLight);
-                    lightDir = normalize(toLight);
-                    float theta = dot(lightDir, normalize(-lights[i].direction));
-                    float cutoff = cos(radians(lights[i].spotAngle));
-                    if (theta > cutoff) {
-                        attenuation = clamp(1.0 - dist / lights[i].range, 0.0, 1.0);
-                        attenuation *= attenuation;
-                        attenuation *= (theta - cutoff) / (1.0 - cutoff);
-                    } else {
-                        attenuation = 0.0;
-                    }
+        layout (std140) uniform Lights {
+            vec4 ambientColor;
+            ivec4 clusterGrid;
+            ivec4 lightCounts;
+            vec4 clusterDepth;
+            vec4 screenSize;
+        };
+        uniform samplerBuffer uLightData;
+        uniform usamplerBuffer uLightGrid;
+        uniform usamplerBuffer uLightIndices;
+
+        Light fetchLight(int index) {
+            int base = int(texelFetch(uLightIndices, index).r) * 4;
+            vec4 a = texelFetch(uLightData, base);
+            vec4 b = texelFetch(uLightData, base + 1);
+            vec4 c = texelFetch(uLightData, base + 2);
+            vec4 d = texelFetch(uLightData, base + 3);
+            return Light(int(a.w), a.xyz, b.xyz, c, d.x, b.w, d.y);
+        }
+
+        // Global (directional) lights live at [0, lightCounts.y) of uLightIndices;
+        // the rest are the lights whose range reaches this fragment's cluster.
+        uvec2 clusterLights() {
+            float ndcDepth = gl_FragCoord.z * 2.0 - 1.0;
+            float zNear = clusterDepth.x;
+            float zFar = clusterDepth.y;
+            float depth = 2.0 * zNear * zFar / (zFar + zNear - ndcDepth * (zFar - zNear));
+            int slice = clamp(int(log(depth / zNear) * clusterDepth.z), 0, clusterGrid.z - 1);
+            ivec2 tile = clamp(ivec2(gl_FragCoord.xy / screenSize.xy * vec2(clusterGrid.xy)), ivec2(0), clusterGrid.xy - 1);
+            return texelFetch(uLightGrid, (slice * clusterGrid.y + tile.y) * clusterGrid.x + tile.x).rg;
+        }
+
+        vec3 shade(Light light, vec3 norm, vec3 viewDir) {
+            vec3 lightDir;
+            float attenuation = 1.0;
+            if (light.type == 0) {
+                lightDir = normalize(-light.direction);
+            } else {
+                vec3 toLight = light.position - FragPos;
+                float dist = length(toLight);
+                lightDir = normalize(toLight);
+                attenuation = clamp(1.0 - dist / light.range, 0.0, 1.0);
+                attenuation *= attenuation;
+                if (light.type == 2) {
+                    float theta = dot(lightDir, -light.direction);
+                    attenuation *= theta > light.spotCos ? (theta - light.spotCos) / (1.0 - light.spotCos) : 0.0;
                 }
+            }
 
-                float diff = max(dot(norm, lightDir), 0.0);
-                vec3 diffuse = diff * lights[i].color.rgb * lights[i].intensity;
-                vec3 halfwayDir = normalize(lightDir + viewDir);
-                float spec = pow(max(dot(norm, halfwayDir), 0.0), 64.0);
-                vec3 specular = spec * lights[i].color.rgb * lights[i].intensity * 0.8;
-                vec3 ambient = lights[i].color.rgb * 0.05;
+            float diff = max(dot(norm, lightDir), 0.0);
+            vec3 diffuse = diff * light.color.rgb * light.intensity;
+            vec3 halfwayDir = normalize(lightDir + viewDir);
+            float spec = pow(max(dot(norm, halfwayDir), 0.0), 64.0);
+            vec3 specular = spec * light.color.rgb * light.intensity * 0.8;
+            vec3 ambient = light.color.rgb * 0.05;
+            return (ambient + diffuse + specular) * attenuation;
+        }
 
-                result += (ambient + diffuse + specular) * attenuation;
+        void main() {
+            vec3 norm = normalize(Normal);
+            vec3 viewDir = normalize(viewPos - FragPos);
+            vec3 result = ambientColor.rgb * ambientColor.a;
+            for (int i = 0; i < lightCounts.y; i++) {
+                result += shade(fetchLight(i), norm, viewDir);
+            }
+            uvec2 cluster = clusterLights();
+            for (uint i = 0u; i < cluster.y; i++) {
+                result += shade(fetchLight(int(cluster.x + i)), norm, viewDir);
             }
 
-            if (numLights == 0) {
+            if (lightCounts.x == 0) {
                 result = vec3(1.0);
             }
 
@@ -221,16 +319,58 @@ private:
         return shader;
     }
 
-    void createMeshBuffers(Mesh* mesh) {
-        if (mesh->renderId == 0) {
-            mesh->renderId = nextMeshId++;
+    void deleteMeshBuffers(MeshBuffers& buffers) {
+        glDeleteVertexArrays(1, &buffers.VAO);
+        glDeleteBuffers(1, &buffers.VBO);
+        glDeleteBuffers(1, &buffers.EBO);
+    }
+
+    void releaseMeshBuffers() {
+        for (unsigned int id : GeometryReleaseQueue::instance().take()) {
+            auto it = meshBufferCache.find(id);
+            if (it == meshBufferCache.end()) continue;
+            deleteMeshBuffers(it->second);
+            meshBufferCache.erase(it);
+        }
+    }
+
+    // Points attributes 0-3 of the bound VAO at the bound GL_ARRAY_BUFFER.
+    void setVertexAttributes(const VertexFormat& format) {
+        GLsizei stride = static_cast<GLsizei>(format.stride());
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+        glEnableVertexAttribArray(0);
+        const void* normalOffset = (void*)format.normalOffset();
+        switch (format.normals) {
+            case VertexFormat::Normals::Float: glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, normalOffset); break;
+            case VertexFormat::Normals::Packed: glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, normalOffset); break;
+            case VertexFormat::Normals::None: break;
+        }
+        const void* texCoordOffset = (void*)format.texCoordOffset();
+        switch (format.texCoords) {
+            case VertexFormat::TexCoords::Float: glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, texCoordOffset); break;
+            case VertexFormat::TexCoords::Half: glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, texCoordOffset); break;
+            case VertexFormat::TexCoords::None: break;
+        }
+        const void* colorOffset = (void*)format.colorOffset();
+        switch (format.colors) {
+            case VertexFormat::Colors::Float: glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, stride, colorOffset); break;
+            case VertexFormat::Colors::RGBA8: glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, colorOffset); break;
+            case VertexFormat::Colors::None: break;
         }
+        // Omitted attributes read the constants set in initialize().
+        auto enable = [](GLuint location, bool enabled) {
+            if (enabled) glEnableVertexAttribArray(location);
+            else glDisableVertexAttribArray(location);
+        };
+        enable(1, format.normals != VertexFormat::Normals::None);
+        enable(2, format.texCoords != VertexFormat::TexCoords::None);
+        enable(3, format.colors != VertexFormat::Colors::None);
+    }
 
-        auto it = meshBufferCache.find(mesh->renderId);
+    MeshBuffers& createMeshBuffers(const MeshData& geometry) {
+        auto it = meshBufferCache.find(geometry.id);
         if (it != meshBufferCache.end()) {
-            glDeleteVertexArrays(1, &it->second.VAO);
-            glDeleteBuffers(1, &it->second.VBO);
-            glDeleteBuffers(1, &it->second.EBO);
+            deleteMeshBuffers(it->second);
         }
 
         MeshBuffers buffers;
@@ -238,48 +378,305 @@ private:
         glGenBuffers(1, &buffers.VBO);
         glGenBuffers(1, &buffers.EBO);
         glBindVertexArray(buffers.VAO);
-        std::vector<float> vertexData;
-        vertexData.reserve(mesh->vertices.size() * 12);
-        for (const auto& v : mesh->vertices) {
-            vertexData.push_back(v.position.x);
-            vertexData.push_back(v.position.y);
-            vertexData.push_back(v.position.z);
-            vertexData.push_back(v.normal.x);
-            vertexData.push_back(v.normal.y);
-            vertexData.push_back(v.normal.z);
-            vertexData.push_back(v.texCoord.x);
-            vertexData.push_back(v.texCoord.y);
-            vertexData.push_back(v.color.r);
-            vertexData.push_back(v.color.g);
-            vertexData.push_back(v.color.b);
-            vertexData.push_back(v.color.a);
-        }
+        VertexFormat format = geometry.format.resolve(geometry.vertices);
+        format.pack(geometry.vertices, vertexData);
 
         glBindBuffer(GL_ARRAY_BUFFER, buffers.VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertexData.size() * sizeof(float), vertexData.data(), GL_STATIC_DRAW);
-        if (!mesh->indices.empty()) {
+        glBufferData(GL_ARRAY_BUFFER, vertexData.size(), vertexData.data(), GL_STATIC_DRAW);
+        buffers.indexType = indexTypeFor(geometry);
+        if (!geometry.indices.empty()) {
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.EBO);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->indices.size() * sizeof(unsigned int), mesh->indices.data(), GL_STATIC_DRAW);
+            if (buffers.indexType == GL_UNSIGNED_SHORT) {
+                indexData.assign(geometry.indices.begin(), geometry.indices.end());
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size() * sizeof(uint16_t), indexData.data(), GL_STATIC_DRAW);
+            } else {
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, geometry.indices.size() * sizeof(unsigned int), geometry.indices.data(), GL_STATIC_DRAW);
+            }
         }
 
-        size_t stride = 12 * sizeof(float);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float)));
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, stride, (void*)(8 * sizeof(float)));
-        glEnableVertexAttribArray(3);
+        setVertexAttributes(format);
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        size_t instanceStride = InstanceFloats * sizeof(float);
+        for (GLuint i = 0; i < 4; i++) {
+            GLuint location = InstanceModelLocation + i;
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, instanceStride, (void*)(i * 4 * sizeof(float)));
+            glEnableVertexAttribArray(location);
+            glVertexAttribDivisor(location, 1);
+        }
+        for (GLuint i = 0; i < 3; i++) {
+            GLuint location = InstanceNormalLocation + i;
+            glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, instanceStride, (void*)((16 + i * 3) * sizeof(float)));
+            glEnableVertexAttribArray(location);
+            glVertexAttribDivisor(location, 1);
+        }
+        glVertexAttribPointer(InstanceColorLocation, 4, GL_FLOAT, GL_FALSE, instanceStride, (void*)(25 * sizeof(float)));
+        glEnableVertexAttribArray(InstanceColorLocation);
+        glVertexAttribDivisor(InstanceColorLocation, 1);
         glBindVertexArray(0);
-        buffers.vertexCount = mesh->vertices.size();
-        buffers.indexCount = mesh->indices.size();
-        if (!mesh->texturePath.empty()) {
-            buffers.textureId = loadTexture(mesh->texturePath);
+        buffers.vertexCount = buffers.vertexCapacity = geometry.vertices.size();
+        buffers.indexCount = buffers.indexCapacity = geometry.indices.size();
+        buffers.version = geometry.version;
+        buffers.format = geometry.format;
+        buffers.layout = format;
+        buffers.updateFrame = frameNumber;
+        geometry.markSynced();
+        return meshBufferCache[geometry.id] = buffers;
+    }
+
+    // Brings existing buffers up to date, uploading only what was edited
+    // since they were last synced. A changed layout needs new attribute
+    // pointers, so that still rebuilds everything.
+    MeshBuffers& updateMeshBuffers(MeshBuffers& buffers, const MeshData& geometry) {
+        VertexFormat format = geometry.format.resolve(geometry.vertices);
+        if (format != buffers.layout) return createMeshBuffers(geometry);
+
+        bool tracked = buffers.version == geometry.syncedVersion();
+        DirtyRange vertices = tracked ? geometry.dirtyVertexRange() : DirtyRange::all();
+        DirtyRange indices = tracked ? geometry.dirtyIndexRange() : DirtyRange::all();
+        GLenum indexType = indexTypeFor(geometry);
+        if (indexType != buffers.indexType) {
+            // Widened or narrowed: every index is rewritten at the new size.
+            buffers.indexType = indexType;
+            buffers.indexCapacity = 0;
+        }
+
+        glBindVertexArray(buffers.VAO);
+        size_t stride = format.stride();
+        glBindBuffer(GL_ARRAY_BUFFER, buffers.VBO);
+        vertices = reserveBuffer(GL_ARRAY_BUFFER, buffers.vertexCapacity, geometry.vertices.size(), stride, vertices);
+        if (!vertices.empty()) {
+            format.pack(geometry.vertices.data() + vertices.begin, vertices.end - vertices.begin, vertexData);
+            glBufferSubData(GL_ARRAY_BUFFER, vertices.begin * stride, vertexData.size(), vertexData.data());
+        }
+
+        size_t indexSize = buffers.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.EBO);
+        indices = reserveBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.indexCapacity, geometry.indices.size(), indexSize, indices);
+        if (!indices.empty()) {
+            const void* source = geometry.indices.data() + indices.begin;
+            if (buffers.indexType == GL_UNSIGNED_SHORT) {
+                indexData.assign(geometry.indices.begin() + indices.begin, geometry.indices.begin() + indices.end);
+                source = indexData.data();
+            }
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indices.begin * indexSize, (indices.end - indices.begin) * indexSize, source);
         }
+        glBindVertexArray(0);
+
+        buffers.vertexCount = geometry.vertices.size();
+        buffers.indexCount = geometry.indices.size();
+        buffers.version = geometry.version;
+        geometry.markSynced();
+        return buffers;
+    }
 
-        meshBufferCache[mesh->renderId] = buffers;
-        mesh->dirty = false;
+    // 16-bit indices whenever every vertex is addressable with them.
+    static GLenum indexTypeFor(const MeshData& geometry) {
+        return geometry.vertices.size() <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
+
+    // Returns the part of `range` that must be written to the bound buffer
+    // for it to hold `count` elements. A buffer that is too small grows by
+    // half again; one about to be rewritten whole is orphaned first so the
+    // driver does not wait for draws still reading the old contents.
+    DirtyRange reserveBuffer(GLenum target, size_t& capacity, size_t count, size_t elementSize, DirtyRange range) {
+        if (count > capacity) {
+            capacity = std::max(count, capacity + capacity / 2);
+            range = DirtyRange::all();
+        }
+        range.end = std::min(range.end, count);
+        if (!range.empty() && range.begin == 0 && range.end == count) {
+            glBufferData(target, capacity * elementSize, nullptr, GL_DYNAMIC_DRAW);
+        }
+        return range;
+    }
+
+    // Writes the whole of `geometry` into this frame's part of the stream
+    // buffer and points the VAO at it. Returns false when it does not fit.
+    bool streamMeshBuffers(MeshBuffers& buffers, const MeshData& geometry) {
+        VertexFormat format = geometry.format.resolve(geometry.vertices);
+        size_t stride = format.stride();
+        GLenum indexType = indexTypeFor(geometry);
+        size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+
+        size_t vertexOffset = 0, indexOffset = 0;
+        uint8_t* out = streamBuffer.map(geometry.vertices.size() * stride, stride, vertexOffset);
+        if (!out) return false;
+        format.pack(geometry.vertices.data(), geometry.vertices.size(), out);
+        streamBuffer.unmap();
+        if (!geometry.indices.empty()) {
+            out = streamBuffer.map(geometry.indices.size() * indexSize, indexSize, indexOffset);
+            if (!out) return false;
+            if (indexType == GL_UNSIGNED_SHORT) {
+                uint16_t* indices = reinterpret_cast<uint16_t*>(out);
+                std::copy(geometry.indices.begin(), geometry.indices.end(), indices);
+            } else {
+                std::memcpy(out, geometry.indices.data(), geometry.indices.size() * indexSize);
+            }
+            streamBuffer.unmap();
+        }
+
+        if (!buffers.streamed || format != buffers.layout) {
+            glBindVertexArray(buffers.VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, streamBuffer.buffer);
+            setVertexAttributes(format);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, streamBuffer.buffer);
+            glBindVertexArray(0);
+            glDeleteBuffers(1, &buffers.VBO);
+            glDeleteBuffers(1, &buffers.EBO);
+            buffers.VBO = buffers.EBO = 0;
+            buffers.vertexCapacity = buffers.indexCapacity = 0;
+        }
+        buffers.streamed = true;
+        buffers.streamFrame = frameNumber;
+        buffers.baseVertex = static_cast<GLint>(vertexOffset / stride);
+        buffers.indexOffset = indexOffset;
+        buffers.indexType = indexType;
+        buffers.vertexCount = geometry.vertices.size();
+        buffers.indexCount = geometry.indices.size();
+        buffers.version = geometry.version;
+        buffers.format = geometry.format;
+        buffers.layout = format;
+        geometry.markSynced();
+        return true;
+    }
+
+    MeshBuffers& getMeshBuffers(const MeshData& geometry) {
+        auto it = meshBufferCache.find(geometry.id);
+        if (it == meshBufferCache.end() || it->second.format != geometry.format) {
+            return createMeshBuffers(geometry);
+        }
+        MeshBuffers& buffers = it->second;
+        if (buffers.version != geometry.version) {
+            bool everyFrame = buffers.updateFrame + 1 >= frameNumber;
+            buffers.updateFrame = frameNumber;
+            if ((everyFrame || buffers.streamed) && streamMeshBuffers(buffers, geometry)) return buffers;
+            if (buffers.streamed) return createMeshBuffers(geometry);
+            return updateMeshBuffers(buffers, geometry);
+        }
+        // Streamed data is only kept until its part of the ring comes round
+        // again, so geometry that has settled goes back to its own buffers.
+        if (buffers.streamed && buffers.streamFrame != frameNumber) {
+            size_t updateFrame = buffers.updateFrame;
+            MeshBuffers& settled = createMeshBuffers(geometry);
+            settled.updateFrame = updateFrame;
+            return settled;
+        }
+        return buffers;
+    }
+
+    void createTextureBuffer(TextureBuffer& tb, GLenum format) {
+        glGenBuffers(1, &tb.buffer);
+        glGenTextures(1, &tb.texture);
+        glBindBuffer(GL_TEXTURE_BUFFER, tb.buffer);
+        glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, tb.texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, format, tb.buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void deleteTextureBuffer(TextureBuffer& tb) {
+        glDeleteTextures(1, &tb.texture);
+        glDeleteBuffers(1, &tb.buffer);
+    }
+
+    template<typename T>
+    void uploadTextureBuffer(const TextureBuffer& tb, const std::vector<T>& data) {
+        size_t bytes = data.size() * sizeof(T);
+        glBindBuffer(GL_TEXTURE_BUFFER, tb.buffer);
+        glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(bytes, 16), nullptr, GL_STREAM_DRAW);
+        if (bytes > 0) glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data.data());
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void uploadLights(const std::vector<Light>& lights, const Color& ambient, const Camera& camera) {
+        lightClusters.build(lights, view, projection, camera.nearPlane, camera.farPlane);
+        uploadTextureBuffer(lightDataBuffer, lightClusters.lightData);
+        uploadTextureBuffer(lightGridBuffer, lightClusters.grid);
+        uploadTextureBuffer(lightIndexBuffer, lightClusters.indices);
+
+        LightBlock block{};
+        block.ambientColor[0] = ambient.r;
+        block.ambientColor[1] = ambient.g;
+        block.ambientColor[2] = ambient.b;
+        block.ambientColor[3] = ambient.a;
+        block.clusterGrid[0] = LightClusters::GridX;
+        block.clusterGrid[1] = LightClusters::GridY;
+        block.clusterGrid[2] = LightClusters::GridZ;
+        block.lightCounts[0] = lightClusters.lightCount;
+        block.lightCounts[1] = lightClusters.globalCount;
+        block.clusterDepth[0] = lightClusters.nearPlane;
+        block.clusterDepth[1] = lightClusters.farPlane;
+        block.clusterDepth[2] = lightClusters.depthScale;
+        block.screenSize[0] = static_cast<float>(windowWidth);
+        block.screenSize[1] = static_cast<float>(windowHeight);
+        glBindBuffer(GL_UNIFORM_BUFFER, lightUBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        glActiveTexture(GL_TEXTURE0 + LightDataUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, lightDataBuffer.texture);
+        glActiveTexture(GL_TEXTURE0 + LightGridUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, lightGridBuffer.texture);
+        glActiveTexture(GL_TEXTURE0 + LightIndexUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, lightIndexBuffer.texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void bindTexture(const UniformLocations& uniforms, GLuint texture) {
+        if (texture != 0) {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            if (uniforms.uTextureSampler != -1) glUniform1i(uniforms.uTextureSampler, 0);
+        }
+        if (uniforms.uHasTexture != -1) glUniform1i(uniforms.uHasTexture, texture != 0 ? 1 : 0);
+    }
+
+    void uploadInstances() {
+        size_t bytes = instanceData.size() * sizeof(float);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        if (bytes > instanceCapacity) {
+            instanceCapacity = std::max(bytes, instanceCapacity * 2);
+        }
+        // Orphan the previous contents so earlier batches still in flight
+        // don't stall this upload.
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instanceData.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Draws batchItems[begin, end), which share geometry and texture, with a
+    // single instanced call.
+    void drawBatch(const UniformLocations& uniforms, size_t begin, size_t end) {
+        const MeshData& geometry = *batchItems[begin].geometry;
+        MeshBuffers& buffers = getMeshBuffers(geometry);
+        instanceData.resize((end - begin) * InstanceFloats);
+        float* out = instanceData.data();
+        for (size_t i = begin; i < end; i++) {
+            const MeshRenderer& renderable = *batchItems[i].renderable;
+            glm::mat4 model = glm::make_mat4(renderable.entity->transform.worldMatrix().data());
+            glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+            const Color& color = renderable.mesh->color;
+            const Color& tint = renderable.tint;
+            out = std::copy_n(glm::value_ptr(model), 16, out);
+            out = std::copy_n(glm::value_ptr(normalMatrix), 9, out);
+            *out++ = color.r * tint.r;
+            *out++ = color.g * tint.g;
+            *out++ = color.b * tint.b;
+            *out++ = color.a * tint.a;
+        }
+        uploadInstances();
+
+        bindTexture(uniforms, batchItems[begin].texture);
+        GLsizei count = static_cast<GLsizei>(end - begin);
+        glBindVertexArray(buffers.VAO);
+        if (buffers.indexCount > 0) {
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, buffers.indexCount, buffers.indexType, (void*)buffers.indexOffset, count, buffers.baseVertex);
+        } else {
+            glDrawArraysInstanced(GL_TRIANGLES, buffers.baseVertex, buffers.vertexCount, count);
+        }
+        glBindVertexArray(0);
     }
 
     void cacheUniformLocations(GLuint program) {
@@ -291,22 +688,20 @@ private:
         uniforms.viewPos = glGetUniformLocation(program, "viewPos");
         uniforms.time = glGetUniformLocation(program, "time");
         uniforms.meshColor = glGetUniformLocation(program, "meshColor");
-        uniforms.ambientColor = glGetUniformLocation(program, "ambientColor");
         uniforms.uHasTexture = glGetUniformLocation(program, "uHasTexture");
         uniforms.uTextureSampler = glGetUniformLocation(program, "uTextureSampler");
-        uniforms.numLights = glGetUniformLocation(program, "numLights");
-        
-        for (int i = 0; i < 8; i++) {
-            std::string prefix = "lights[" + std::to_string(i) + "].";
-            uniforms.lights[i][0] = glGetUniformLocation(program, (prefix + "type").c_str());
-            uniforms.lights[i][1] = glGetUniformLocation(program, (prefix + "position").c_str());
-            uniforms.lights[i][2] = glGetUniformLocation(program, (prefix + "direction").c_str());
-            uniforms.lights[i][3] = glGetUniformLocation(program, (prefix + "color").c_str());
-            uniforms.lights[i][4] = glGetUniformLocation(program, (prefix + "intensity").c_str());
-            uniforms.lights[i][5] = glGetUniformLocation(program, (prefix + "range").c_str());
-            uniforms.lights[i][6] = glGetUniformLocation(program, (prefix + "spotAngle").c_str());
-            uniforms.lights[i][7] = glGetUniformLocation(program, (prefix + "constant").c_str());
-            uniforms.lights[i][8] = glGetUniformLocation(program, (prefix + "linear").c_str());
+        uniforms.instanced = glGetUniformLocation(program, "uInstanced");
+        uniforms.instancing = uniforms.instanced != -1 &&
+            glGetAttribLocation(program, "iModel") == static_cast<GLint>(InstanceModelLocation);
+
+        GLuint lightBlock = glGetUniformBlockIndex(program, "Lights");
+        if (lightBlock != GL_INVALID_INDEX) {
+            glUniformBlockBinding(program, lightBlock, LightBlockBinding);
+            glUseProgram(program);
+            glUniform1i(glGetUniformLocation(program, "uLightData"), LightDataUnit);
+            glUniform1i(glGetUniformLocation(program, "uLightGrid"), LightGridUnit);
+            glUniform1i(glGetUniformLocation(program, "uLightIndices"), LightIndexUnit);
+            glUseProgram(activeProgram);
         }
         
         uniformCache[program] = uniforms;
@@ -406,12 +801,31 @@ public:
         glDeleteShader(vertexShader);
         glDeleteShader(fragmentShader);
         cacheUniformLocations(shaderProgram);
+        activeProgram = shaderProgram;
+        glVertexAttrib3f(1, 0.0f, 1.0f, 0.0f);
+        glVertexAttrib2f(2, 0.0f, 0.0f);
+        glVertexAttrib4f(3, 1.0f, 1.0f, 1.0f, 1.0f);
+        glGenBuffers(1, &instanceVBO);
+        instanceData.resize(InstanceFloats);
+        uploadInstances();
+        glGenBuffers(1, &lightUBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, lightUBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlock), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, LightBlockBinding, lightUBO);
+        createTextureBuffer(lightDataBuffer, GL_RGBA32F);
+        createTextureBuffer(lightGridBuffer, GL_RG32UI);
+        createTextureBuffer(lightIndexBuffer, GL_R32UI);
+        streamBuffer.create(StreamBytesPerFrame);
         projection = glm::perspective(glm::radians(60.0f), (float)width / (float)height, 0.1f, 1000.0f);
         return true;
     }
 
-    void beginFrame(const Camera& camera) override {
+    void beginFrame(const Camera& camera, const std::vector<Light>& lights, const Color& ambient) override {
         glfwPollEvents();
+        releaseMeshBuffers();
+        frameNumber++;
+        streamBuffer.beginFrame();
         int w, h;
         glfwGetFramebufferSize(window, &w, &h);
         if (w != windowWidth || h != windowHeight) {
@@ -420,12 +834,9 @@ public:
             glViewport(0, 0, w, h);
         }
 
-        projection = glm::perspective(glm::radians(camera.fov), (float)windowWidth / (float)windowHeight, camera.nearPlane, camera.farPlane);
-        view = glm::mat4(1.0f);
-        view = glm::rotate(view, glm::radians(camera.rotation.x), glm::vec3(1, 0, 0));
-        view = glm::rotate(view, glm::radians(camera.rotation.y), glm::vec3(0, 1, 0));
-        view = glm::rotate(view, glm::radians(camera.rotation.z), glm::vec3(0, 0, 1));
-        view = glm::translate(view, glm::vec3(-camera.position.x, -camera.position.y, -camera.position.z));
+        projection = glm::make_mat4(camera.projectionMatrix((float)windowWidth / (float)windowHeight).data());
+        view = glm::make_mat4(camera.viewMatrix().data());
+        uploadLights(lights, ambient, camera);
         glClearColor(camera.clearColor.r, camera.clearColor.g, camera.clearColor.b, camera.clearColor.a);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         if (wireframeMode) {
@@ -434,66 +845,79 @@ public:
             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
         }
 
-        glUseProgram(shaderProgram);
-        auto& uniforms = uniformCache[shaderProgram];
+        glUseProgram(activeProgram);
+        auto& uniforms = uniformCache[activeProgram];
         if (uniforms.view != -1) glUniformMatrix4fv(uniforms.view, 1, GL_FALSE, glm::value_ptr(view));
         if (uniforms.projection != -1) glUniformMatrix4fv(uniforms.projection, 1, GL_FALSE, glm::value_ptr(projection));
         if (uniforms.viewPos != -1) glUniform3f(uniforms.viewPos, camera.position.x, camera.position.y, camera.position.z);
         if (uniforms.time != -1) glUniform1f(uniforms.time, static_cast<float>(glfwGetTime()));
     }
 
-    void renderMesh(Mesh* mesh, const std::vector<Light>& lights, const Color& ambient) override {
-        if (mesh->vertices.empty()) return;
-        if (mesh->dirty || meshBufferCache.find(mesh->renderId) == meshBufferCache.end()) {
-            createMeshBuffers(mesh);
-        }
-
-        auto& buffers = meshBufferCache[mesh->renderId];
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(mesh->transform.position.x, mesh->transform.position.y, mesh->transform.position.z));
-        model = glm::rotate(model, glm::radians(mesh->transform.rotation.x), glm::vec3(1, 0, 0));
-        model = glm::rotate(model, glm::radians(mesh->transform.rotation.y), glm::vec3(0, 1, 0));
-        model = glm::rotate(model, glm::radians(mesh->transform.rotation.z), glm::vec3(0, 0, 1));
-        model = glm::scale(model, glm::vec3(mesh->transform.scale.x, mesh->transform.scale.y, mesh->transform.scale.z));
+    void renderMesh(const MeshRenderer& renderable) override {
+        Mesh* mesh = renderable.mesh;
+        const MeshData& geometry = *renderable.geometry();
+        if (geometry.vertices.empty()) return;
+        MeshBuffers& buffers = getMeshBuffers(geometry);
+        glm::mat4 model = glm::make_mat4(renderable.entity->transform.worldMatrix().data());
         glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
-        GLuint currentProgram = shaderProgram;
         
-        auto& uniforms = uniformCache[currentProgram];
+        auto& uniforms = uniformCache[activeProgram];
+        if (uniforms.instanced != -1) glUniform1i(uniforms.instanced, 0);
         if (uniforms.model != -1) glUniformMatrix4fv(uniforms.model, 1, GL_FALSE, glm::value_ptr(model));
         if (uniforms.normalMatrix != -1) glUniformMatrix3fv(uniforms.normalMatrix, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-        if (uniforms.meshColor != -1) glUniform4f(uniforms.meshColor, mesh->color.r, mesh->color.g, mesh->color.b, mesh->color.a);
-        if (uniforms.ambientColor != -1) glUniform4f(uniforms.ambientColor, ambient.r, ambient.g, ambient.b, ambient.a);
-        bool hasTexture = false;
-        if (buffers.textureId != 0) {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, buffers.textureId);
-            if (uniforms.uTextureSampler != -1) glUniform1i(uniforms.uTextureSampler, 0);
-            hasTexture = true;
-        }
-        if (uniforms.uHasTexture != -1) glUniform1i(uniforms.uHasTexture, hasTexture ? 1 : 0);
-        int numLights = std::min(static_cast<int>(lights.size()), 8);
-        if (uniforms.numLights != -1) glUniform1i(uniforms.numLights, numLights);
-        for (int i = 0; i < numLights; i++) {
-            if (uniforms.lights[i][0] != -1) glUniform1i(uniforms.lights[i][0], static_cast<int>(lights[i].type));
-            if (uniforms.lights[i][1] != -1) glUniform3f(uniforms.lights[i][1], lights[i].position.x, lights[i].position.y, lights[i].position.z);
-            if (uniforms.lights[i][2] != -1) glUniform3f(uniforms.lights[i][2], lights[i].direction.x, lights[i].direction.y, lights[i].direction.z);
-            if (uniforms.lights[i][3] != -1) glUniform4f(uniforms.lights[i][3], lights[i].color.r, lights[i].color.g, lights[i].color.b, lights[i].color.a);
-            if (uniforms.lights[i][4] != -1) glUniform1f(uniforms.lights[i][4], lights[i].intensity);
-            if (uniforms.lights[i][5] != -1) glUniform1f(uniforms.lights[i][5], lights[i].range);
-            if (uniforms.lights[i][6] != -1) glUniform1f(uniforms.lights[i][6], lights[i].spotAngle);
-        }
+        const Color& tint = renderable.tint;
+        if (uniforms.meshColor != -1) glUniform4f(uniforms.meshColor, mesh->color.r * tint.r, mesh->color.g * tint.g, mesh->color.b * tint.b, mesh->color.a * tint.a);
+        bindTexture(uniforms, mesh->texturePath.empty() ? 0 : loadTexture(mesh->texturePath));
 
         glBindVertexArray(buffers.VAO);
         if (buffers.indexCount > 0) {
-            glDrawElements(GL_TRIANGLES, buffers.indexCount, GL_UNSIGNED_INT, 0);
+            glDrawElementsBaseVertex(GL_TRIANGLES, buffers.indexCount, buffers.indexType, (void*)buffers.indexOffset, buffers.baseVertex);
         } else {
-            glDrawArrays(GL_TRIANGLES, 0, buffers.vertexCount);
+            glDrawArrays(GL_TRIANGLES, buffers.baseVertex, buffers.vertexCount);
         }
 
         glBindVertexArray(0);
     }
 
+    // Groups renderables by geometry and texture and draws each group with
+    // one instanced call. Shaders without the per-instance inputs fall back
+    // to one draw per mesh.
+    void renderMeshes(const std::vector<MeshRenderer*>& renderables) override {
+        auto& uniforms = uniformCache[activeProgram];
+        if (!uniforms.instancing) {
+            IRenderer::renderMeshes(renderables);
+            return;
+        }
+
+        batchItems.clear();
+        for (const MeshRenderer* renderable : renderables) {
+            const Mesh* mesh = renderable->mesh;
+            const MeshData* geometry = renderable->geometry();
+            if (geometry->vertices.empty()) continue;
+            GLuint texture = mesh->texturePath.empty() ? 0 : loadTexture(mesh->texturePath);
+            batchItems.push_back({geometry, texture, renderable});
+        }
+        std::sort(batchItems.begin(), batchItems.end(), [](const BatchItem& a, const BatchItem& b) {
+            if (a.texture != b.texture) return a.texture < b.texture;
+            return a.geometry->id < b.geometry->id;
+        });
+
+        glUniform1i(uniforms.instanced, 1);
+        if (uniforms.meshColor != -1) glUniform4f(uniforms.meshColor, 1.0f, 1.0f, 1.0f, 1.0f);
+        for (size_t begin = 0; begin < batchItems.size();) {
+            size_t end = begin + 1;
+            while (end < batchItems.size() && batchItems[end].geometry == batchItems[begin].geometry &&
+                   batchItems[end].texture == batchItems[begin].texture) {
+                end++;
+            }
+            drawBatch(uniforms, begin, end);
+            begin = end;
+        }
+        glUniform1i(uniforms.instanced, 0);
+    }
+
     void endFrame() override {
+        streamBuffer.endFrame();
         glfwSwapBuffers(window);
     }
 
@@ -586,24 +1010,23 @@ public:
     
     void useShader(const std::string& name) override {
         auto it = shaderPrograms.find(name);
-        if (it != shaderPrograms.end()) {
-            glUseProgram(it->second);
-            auto& uniforms = uniformCache[it->second];
-            if (uniforms.time != -1) glUniform1f(uniforms.time, static_cast<float>(glfwGetTime()));
-        } else {
-            glUseProgram(shaderProgram);
-            auto& uniforms = uniformCache[shaderProgram];
-            if (uniforms.time != -1) glUniform1f(uniforms.time, static_cast<float>(glfwGetTime()));
-        }
+        activeProgram = it != shaderPrograms.end() ? it->second : shaderProgram;
+        glUseProgram(activeProgram);
+        auto& uniforms = uniformCache[activeProgram];
+        if (uniforms.time != -1) glUniform1f(uniforms.time, static_cast<float>(glfwGetTime()));
     }
 
     void shutdown() override {
         for (auto& [id, buffers] : meshBufferCache) {
-            glDeleteVertexArrays(1, &buffers.VAO);
-            glDeleteBuffers(1, &buffers.VBO);
-            glDeleteBuffers(1, &buffers.EBO);
+            deleteMeshBuffers(buffers);
         }
         meshBufferCache.clear();
+        streamBuffer.destroy();
+        glDeleteBuffers(1, &instanceVBO);
+        glDeleteBuffers(1, &lightUBO);
+        deleteTextureBuffer(lightDataBuffer);
+        deleteTextureBuffer(lightGridBuffer);
+        deleteTextureBuffer(lightIndexBuffer);
         for (auto& [path, texture] : textureCache) {
             glDeleteTextures(1, &texture.id);
         }
@@ -0,0 +1,132 @@
+/*
+   Copyright 2025 NEOAPPS
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef COMBINE_STREAM_BUFFER_H
+#define COMBINE_STREAM_BUFFER_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace Combine {
+
+// Ring buffer for geometry that is rewritten every frame. Each frame writes
+// into its own third of one buffer, and a fence placed when the frame ends
+// keeps the CPU from reusing that third before the GPU has read it.
+//
+// With GL 4.4 or ARB_buffer_storage the buffer is mapped once, persistently
+// and coherently. On plain GL 3.3 every write maps its range unsynchronized,
+// which the same fences make safe.
+class StreamBuffer {
+public:
+    static constexpr int Frames = 3;
+
+    GLuint buffer = 0;
+
+    void create(size_t bytesPerFrame) {
+        frameSize = bytesPerFrame;
+        GLsizeiptr size = static_cast<GLsizeiptr>(frameSize * Frames);
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+        if (persistent) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+            mapped = static_cast<uint8_t*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+            if (!mapped) {
+                // Storage is immutable, so start over with a plain buffer.
+                glDeleteBuffers(1, &buffer);
+                glGenBuffers(1, &buffer);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+                persistent = false;
+            }
+        }
+        if (!persistent) {
+            glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    void destroy() {
+        for (GLsync& fence : fences) {
+            if (fence) glDeleteSync(fence);
+            fence = nullptr;
+        }
+        if (mapped) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            mapped = nullptr;
+        }
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        frameSize = 0;
+    }
+
+    // Moves on to the next third, waiting for the GPU if it is still reading
+    // what was written there Frames frames ago.
+    void beginFrame() {
+        frame = (frame + 1) % Frames;
+        offset = 0;
+        GLsync& fence = fences[frame];
+        if (!fence) return;
+        GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        while (result == GL_TIMEOUT_EXPIRED) {
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    void endFrame() {
+        if (buffer && offset > 0) fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    // Reserves `size` bytes at a buffer offset that is a multiple of
+    // `alignment` and returns where to write them, or nullptr when this
+    // frame's third is full. Each write must be followed by unmap().
+    uint8_t* map(size_t size, size_t alignment, size_t& bufferOffset) {
+        size_t base = frame * frameSize;
+        size_t start = (base + offset + alignment - 1) / alignment * alignment;
+        if (size == 0 || start + size > base + frameSize) return nullptr;
+        offset = start + size - base;
+        bufferOffset = start;
+        if (persistent) return mapped + start;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        void* out = glMapBufferRange(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(start), static_cast<GLsizeiptr>(size),
+                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (!out) glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return static_cast<uint8_t*>(out);
+    }
+
+    void unmap() {
+        if (persistent) return;
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+private:
+    size_t frameSize = 0;
+    size_t offset = 0;
+    int frame = 0;
+    bool persistent = false;
+    uint8_t* mapped = nullptr;
+    GLsync fences[Frames] = {};
+};
+
+}
+
+#endif
@@ -19,6 +19,7 @@
 
 #include "../CombineEngine.h"
 #include "../MapLoader.h"
+#include "../MeshSimplifier.h"
 #include <chaiscript/chaiscript.hpp>
 #include <iostream>
 #include <functional>
@@ -32,6 +33,37 @@ private:
     std::vector<std::function<void(float)>> lateUpdateCallbacks;
     std::string currentFile = "script";
 
+    template<typename T>
+    static T& resolve(EntityId id) {
+        T* entity = g_engine->getScene()->getEntity<T>(id);
+        if (!entity) throw std::runtime_error("stale entity handle");
+        return *entity;
+    }
+
+    // What a create* function returns. It converts to EntityId wherever one
+    // is expected, and once the script drops every copy the entity is freed
+    // if it was never added to the scene.
+    struct SpawnedEntity {
+        std::shared_ptr<EntityId> id;
+        operator EntityId() const { return *id; }
+    };
+
+    static SpawnedEntity spawn(std::shared_ptr<Entity> entity) {
+        EntityId id = g_engine->getScene()->spawn(std::move(entity));
+        return {std::shared_ptr<EntityId>(new EntityId(id), [](EntityId* p) {
+            if (g_engine && g_engine->getScene()) g_engine->getScene()->releaseSpawned(*p);
+            delete p;
+        })};
+    }
+
+    static std::vector<std::string> componentNames(const std::vector<chaiscript::Boxed_Value>& values) {
+        std::vector<std::string> names;
+        for (auto& value : values) {
+            names.push_back(chaiscript::boxed_cast<std::string>(value));
+        }
+        return names;
+    }
+
 public:
     bool initialize() override {
         chai = std::make_unique<chaiscript::ChaiScript>();
@@ -102,13 +134,30 @@ public:
         chai->add(chaiscript::fun(&Transform::rotate), "rotate");
         chai->add(chaiscript::user_type<Entity>(), "Entity");
         chai->add(chaiscript::fun(&Entity::transform), "transform");
-        chai->add(chaiscript::fun(&Entity::name), "name");
-        chai->add(chaiscript::fun(&Entity::tag), "tag");
+        // name and tag are returned by value so the scene's indexes can't be
+        // bypassed; ChaiScript rejects `e.name = x`, scripts call setName.
+        chai->add(chaiscript::fun([](const Entity& e) { return e.name; }), "name");
+        chai->add(chaiscript::fun([](const Entity& e) { return e.tag; }), "tag");
+        chai->add(chaiscript::fun(&Entity::setName), "setName");
+        chai->add(chaiscript::fun(&Entity::setTag), "setTag");
         chai->add(chaiscript::fun(&Entity::active), "active");
-        chai->add(chaiscript::fun([](const std::shared_ptr<Entity>& a, const std::shared_ptr<Entity>& b) { return a == b; }), "==");
-        chai->add(chaiscript::fun([](const std::shared_ptr<Entity>& a, const std::shared_ptr<Entity>& b) { return a != b; }), "!=");
-        chai->add(chaiscript::fun([](const std::shared_ptr<Entity>& a) { return a == nullptr; }), "==");
-        chai->add(chaiscript::fun([](const std::shared_ptr<Entity>& a) { return a != nullptr; }), "!=");
+        chai->add(chaiscript::user_type<EntityId>(), "EntityId");
+        chai->add(chaiscript::constructor<EntityId()>(), "EntityId");
+        chai->add(chaiscript::fun([](const EntityId& a, const EntityId& b) { return a == b; }), "==");
+        chai->add(chaiscript::fun([](const EntityId& a, const EntityId& b) { return a != b; }), "!=");
+        chai->add(chaiscript::fun([](const EntityId& id) { return g_engine->getScene()->isValid(id); }), "valid");
+        chai->add(chaiscript::user_type<SpawnedEntity>(), "SpawnedEntity");
+        chai->add(chaiscript::type_conversion<SpawnedEntity, EntityId>());
+        chai->add(chaiscript::bootstrap::standard_library::vector_type<std::vector<EntityId>>("EntityIdVector"));
+        chai->add(chaiscript::fun([](EntityId id) -> Transform& { return resolve<Entity>(id).transform; }), "transform");
+        chai->add(chaiscript::fun([](EntityId id) { return resolve<Entity>(id).name; }), "name");
+        chai->add(chaiscript::fun([](EntityId id) { return resolve<Entity>(id).tag; }), "tag");
+        chai->add(chaiscript::fun([](EntityId id, const std::string& n) { resolve<Entity>(id).setName(n); }), "setName");
+        chai->add(chaiscript::fun([](EntityId id, const std::string& t) { resolve<Entity>(id).setTag(t); }), "setTag");
+        chai->add(chaiscript::fun([](EntityId id) -> bool& { return resolve<Entity>(id).active; }), "active");
+        chai->add(chaiscript::fun([](EntityId id, EntityId parent) {
+            return resolve<Entity>(id).setParent(parent.isValid() ? &resolve<Entity>(parent) : nullptr);
+        }), "setParent");
         chai->add(chaiscript::user_type<Vertex>(), "Vertex");
         chai->add(chaiscript::constructor<Vertex()>(), "Vertex");
         chai->add(chaiscript::constructor<Vertex(const Vector3&)>(), "Vertex");
@@ -119,41 +168,69 @@ public:
         chai->add(chaiscript::user_type<Mesh>(), "Mesh");
         chai->add(chaiscript::base_class<Entity, Mesh>());
         chai->add(chaiscript::fun(&Mesh::color), "color");
-        chai->add(chaiscript::fun(&Mesh::dirty), "dirty");
         chai->add(chaiscript::fun([](Mesh& m, const Vertex& v) { m.addVertex(v); }), "addVertex");
         chai->add(chaiscript::fun([](Mesh& m, float x, float y, float z) { m.addVertex(x, y, z); }), "addVertex");
-        chai->add(chaiscript::fun([](std::shared_ptr<Mesh> m, const Vertex& v) { m->addVertex(v); }), "addVertex");
-        chai->add(chaiscript::fun([](std::shared_ptr<Mesh> m, float x, float y, float z) { m->addVertex(x, y, z); }), "addVertex");
         chai->add(chaiscript::fun(&Mesh::addIndex), "addIndex");
         chai->add(chaiscript::fun(&Mesh::addTriangle), "addTriangle");
         chai->add(chaiscript::fun(&Mesh::clear), "clear");
         chai->add(chaiscript::fun(&Mesh::calculateNormals), "calculateNormals");
-        chai->add(chaiscript::fun([](const std::string& name) -> std::shared_ptr<Mesh> {
-            return std::make_shared<Mesh>(name);
+        chai->add(chaiscript::fun([](EntityId id) -> Color& { return resolve<Mesh>(id).color; }), "color");
+        chai->add(chaiscript::fun([](EntityId id, const Vertex& v) { resolve<Mesh>(id).addVertex(v); }), "addVertex");
+        chai->add(chaiscript::fun([](EntityId id, float x, float y, float z) { resolve<Mesh>(id).addVertex(x, y, z); }), "addVertex");
+        chai->add(chaiscript::fun([](EntityId id, unsigned int index) { resolve<Mesh>(id).addIndex(index); }), "addIndex");
+        chai->add(chaiscript::fun([](EntityId id, unsigned int i0, unsigned int i1, unsigned int i2) { resolve<Mesh>(id).addTriangle(i0, i1, i2); }), "addTriangle");
+        chai->add(chaiscript::fun([](EntityId id) { resolve<Mesh>(id).clear(); }), "clear");
+        chai->add(chaiscript::fun([](EntityId id) { resolve<Mesh>(id).calculateNormals(); }), "calculateNormals");
+        // simplify(mesh, ratio[, maxError]) replaces the geometry and returns the error reached.
+        auto simplify = [](Mesh& m, float ratio, float maxError) {
+            float error = 0.0f;
+            m.setGeometry(MeshSimplifier::simplify(m, ratio, maxError, &error));
+            return error;
+        };
+        chai->add(chaiscript::fun([simplify](Mesh& m, float ratio) { return simplify(m, ratio, std::numeric_limits<float>::infinity()); }), "simplify");
+        chai->add(chaiscript::fun([simplify](Mesh& m, float ratio, float maxError) { return simplify(m, ratio, maxError); }), "simplify");
+        chai->add(chaiscript::fun([simplify](EntityId id, float ratio) { return simplify(resolve<Mesh>(id), ratio, std::numeric_limits<float>::infinity()); }), "simplify");
+        chai->add(chaiscript::fun([simplify](EntityId id, float ratio, float maxError) { return simplify(resolve<Mesh>(id), ratio, maxError); }), "simplify");
+        // optimize(mesh) reorders the buffers for the GPU and returns the ACMR before and after.
+        chai->add(chaiscript::user_type<MeshOptimizationStats>(), "MeshOptimizationStats");
+        chai->add(chaiscript::fun(&MeshOptimizationStats::acmrBefore), "acmrBefore");
+        chai->add(chaiscript::fun(&MeshOptimizationStats::acmrAfter), "acmrAfter");
+        chai->add(chaiscript::fun([](Mesh& m) { return MeshOptimizer::optimize(m); }), "optimize");
+        chai->add(chaiscript::fun([](EntityId id) { return MeshOptimizer::optimize(resolve<Mesh>(id)); }), "optimize");
+        auto generateLODs = [](Mesh& m, int levels, float ratio) {
+            m.lod = MeshSimplifier::generateLODs(m.geometry(), levels, ratio);
+            return static_cast<int>(m.lod->levels.size());
+        };
+        chai->add(chaiscript::fun([generateLODs](Mesh& m) { return generateLODs(m, 4, 0.5f); }), "generateLODs");
+        chai->add(chaiscript::fun([generateLODs](Mesh& m, int levels, float ratio) { return generateLODs(m, levels, ratio); }), "generateLODs");
+        chai->add(chaiscript::fun([generateLODs](EntityId id) { return generateLODs(resolve<Mesh>(id), 4, 0.5f); }), "generateLODs");
+        chai->add(chaiscript::fun([generateLODs](EntityId id, int levels, float ratio) { return generateLODs(resolve<Mesh>(id), levels, ratio); }), "generateLODs");
+        chai->add(chaiscript::fun([](const std::string& name) -> SpawnedEntity {
+            return spawn(std::make_shared<Mesh>(name));
         }), "createMesh");
 
-        chai->add(chaiscript::fun([](const std::string& name) -> std::shared_ptr<Mesh> {
-            return Mesh::createCube(name);
+        chai->add(chaiscript::fun([](const std::string& name) -> SpawnedEntity {
+            return spawn(Mesh::createCube(name));
         }), "createCube");
 
-        chai->add(chaiscript::fun([](const std::string& name, float width, float height) -> std::shared_ptr<Mesh> {
-            return Mesh::createPlane(name, width, height);
+        chai->add(chaiscript::fun([](const std::string& name, float width, float height) -> SpawnedEntity {
+            return spawn(Mesh::createPlane(name, width, height));
         }), "createPlane");
 
-        chai->add(chaiscript::fun([](const std::string& name, int segments, int rings) -> std::shared_ptr<Mesh> {
-            return Mesh::createSphere(name, segments, rings);
+        chai->add(chaiscript::fun([](const std::string& name, int segments, int rings) -> SpawnedEntity {
+            return spawn(Mesh::createSphere(name, segments, rings));
         }), "createSphere");
 
-        chai->add(chaiscript::fun([]() -> std::shared_ptr<Mesh> {
-            return Mesh::createCube();
+        chai->add(chaiscript::fun([]() -> SpawnedEntity {
+            return spawn(Mesh::createCube());
         }), "createCube");
 
-        chai->add(chaiscript::fun([]() -> std::shared_ptr<Mesh> {
-            return Mesh::createPlane();
+        chai->add(chaiscript::fun([]() -> SpawnedEntity {
+            return spawn(Mesh::createPlane());
         }), "createPlane");
 
-        chai->add(chaiscript::fun([]() -> std::shared_ptr<Mesh> {
-            return Mesh::createSphere();
+        chai->add(chaiscript::fun([]() -> SpawnedEntity {
+            return spawn(Mesh::createSphere());
         }), "createSphere");
 
         chai->add(chaiscript::user_type<Camera>(), "Camera");
@@ -201,15 +278,21 @@ public:
         chai->add(chaiscript::fun([](Scene* s) -> Camera* { return &s->camera; }), "getCamera");
         chai->add(chaiscript::fun([](Scene& s) -> Color& { return s.ambientColor; }), "ambientColor");
         chai->add(chaiscript::fun([](Scene* s) -> Color& { return s->ambientColor; }), "ambientColor");
-        chai->add(chaiscript::fun([](Scene* s, std::shared_ptr<Entity> e) { s->addEntity(e); }), "addEntity");
-        chai->add(chaiscript::fun([](Scene* s, std::shared_ptr<Entity> e) { s->removeEntity(e); }), "removeEntity");
+        chai->add(chaiscript::fun([](Scene* s, EntityId id) { s->addEntity(id); }), "addEntity");
+        chai->add(chaiscript::fun([](Scene* s, EntityId id) { s->removeEntity(id); }), "removeEntity");
         chai->add(chaiscript::fun([](Scene* s, const std::string& n) { s->removeEntityByName(n); }), "removeEntityByName");
         chai->add(chaiscript::fun([](Scene* s, const std::string& n) { return s->getEntityByName(n); }), "getEntityByName");
         chai->add(chaiscript::fun([](Scene* s, const std::string& t) { return s->getEntitiesByTag(t); }), "getEntitiesByTag");
+        chai->add(chaiscript::fun([](Scene* s, const std::vector<chaiscript::Boxed_Value>& names) {
+            return s->query(componentNames(names));
+        }), "query");
         chai->add(chaiscript::fun([](Scene* s, const Light& l) { s->addLight(l); }), "addLight");
         chai->add(chaiscript::fun([](Scene* s) { s->clear(); }), "clear");
-        chai->add(chaiscript::fun([](Scene* scene) -> std::vector<std::shared_ptr<Entity>>& {
-            return scene->entities;
+        chai->add(chaiscript::fun([](Scene* scene) {
+            std::vector<EntityId> ids;
+            ids.reserve(scene->entities.size());
+            for (auto& entity : scene->entities) ids.push_back(entity->id);
+            return ids;
         }), "entities");
         chai->add(chaiscript::fun([](Scene* scene) -> std::vector<Light>& {
             return scene->lights;
@@ -219,13 +302,58 @@ public:
             return g_engine->getScene();
         }), "getScene");
 
-        chai->add(chaiscript::fun([](std::shared_ptr<Entity> entity) {
-            g_engine->getScene()->addEntity(entity);
+        chai->add(chaiscript::fun([](EntityId id) {
+            g_engine->getScene()->addEntity(id);
         }), "addEntity");
 
-        chai->add(chaiscript::fun([](std::shared_ptr<Mesh> mesh) {
-            g_engine->getScene()->addEntity(std::static_pointer_cast<Entity>(mesh));
-        }), "addEntity");
+        chai->add(chaiscript::fun([](EntityId id) {
+            g_engine->getScene()->removeEntity(id);
+        }), "removeEntity");
+
+        chai->add(chaiscript::fun([](const std::vector<chaiscript::Boxed_Value>& names) {
+            return g_engine->getScene()->query(componentNames(names));
+        }), "query");
+
+        chai->add(chaiscript::user_type<RaycastHit>(), "RaycastHit");
+        chai->add(chaiscript::fun(&RaycastHit::entity), "entity");
+        chai->add(chaiscript::fun(&RaycastHit::distance), "distance");
+        chai->add(chaiscript::fun(&RaycastHit::point), "point");
+        chai->add(chaiscript::fun(&RaycastHit::normal), "normal");
+        chai->add(chaiscript::fun(&RaycastHit::triangle), "triangle");
+        chai->add(chaiscript::fun([](const Vector3& min, const Vector3& max) {
+            return g_engine->getScene()->queryBox(BoundingBox(min, max));
+        }), "queryBox");
+        chai->add(chaiscript::fun([](const Vector3& center, float radius) {
+            return g_engine->getScene()->querySphere(center, radius);
+        }), "querySphere");
+        chai->add(chaiscript::fun([](const Vector3& point, int k) {
+            return g_engine->getScene()->nearest(point, k > 0 ? static_cast<size_t>(k) : 0);
+        }), "nearest");
+        chai->add(chaiscript::fun([](const Vector3& point, int k, float maxDistance) {
+            return g_engine->getScene()->nearest(point, k > 0 ? static_cast<size_t>(k) : 0, maxDistance);
+        }), "nearest");
+        // Returns a hit with an invalid entity when nothing was hit.
+        chai->add(chaiscript::fun([](const Vector3& origin, const Vector3& direction) {
+            RaycastHit hit;
+            g_engine->getScene()->raycast(origin, direction, hit);
+            return hit;
+        }), "raycast");
+        chai->add(chaiscript::fun([](const Vector3& origin, const Vector3& direction, float maxDistance) {
+            RaycastHit hit;
+            g_engine->getScene()->raycast(origin, direction, hit, maxDistance);
+            return hit;
+        }), "raycast");
+        chai->add(chaiscript::fun([]() {
+            Vector2 mouse = Input::instance().getMousePosition();
+            RaycastHit hit;
+            g_engine->pick(mouse.x, mouse.y, hit);
+            return hit;
+        }), "pick");
+        chai->add(chaiscript::fun([](float x, float y) {
+            RaycastHit hit;
+            g_engine->pick(x, y, hit);
+            return hit;
+        }), "pick");
 
         chai->add(chaiscript::fun([]() -> Camera* {
             return &g_engine->getScene()->camera;
@@ -369,6 +497,14 @@ public:
             return Time::instance().getFPS();
         }), "fps");
 
+        chai->add(chaiscript::fun([]() -> int {
+            return static_cast<int>(g_engine->getCullingStats().visible);
+        }), "visibleCount");
+
+        chai->add(chaiscript::fun([]() -> int {
+            return static_cast<int>(g_engine->getCullingStats().culled);
+        }), "culledCount");
+
         auto& callbacks = updateCallbacks;
         chai->add(chaiscript::fun([&callbacks](const std::function<void(float)>& func) {
             callbacks.push_back(func);
@@ -19,6 +19,7 @@
 
 #include "../CombineEngine.h"
 #include "../MapLoader.h"
+#include "../MeshSimplifier.h"
 #include <lua.hpp>
 #include <iostream>
 #include <functional>
@@ -64,6 +65,60 @@ private:
         return 0;
     }
 
+    // The handle a create* function returns owns its entity until it is
+    // added, so a mesh the script drops first is freed when it is collected.
+    struct EntityHandle {
+        EntityId id;
+        bool owner;
+    };
+
+    static void pushEntity(lua_State* L, EntityId id, bool owner = false) {
+        EntityHandle* handle = (EntityHandle*)lua_newuserdata(L, sizeof(EntityHandle));
+        new (handle) EntityHandle{id, owner};
+        luaL_setmetatable(L, "Mesh");
+    }
+
+    static EntityId* checkEntity(lua_State* L, int idx) {
+        return &((EntityHandle*)luaL_checkudata(L, idx, "Mesh"))->id;
+    }
+
+    static Mesh* checkMesh(lua_State* L, int idx) {
+        EntityId* id = checkEntity(L, idx);
+        Mesh* mesh = g_engine->getScene()->getEntity<Mesh>(*id);
+        if (!mesh) luaL_error(L, "stale entity handle");
+        return mesh;
+    }
+
+    static void pushEntities(lua_State* L, const std::vector<EntityId>& ids) {
+        lua_createtable(L, static_cast<int>(ids.size()), 0);
+        for (size_t i = 0; i < ids.size(); i++) {
+            pushEntity(L, ids[i]);
+            lua_rawseti(L, -2, static_cast<int>(i + 1));
+        }
+    }
+
+    static Vector3 checkVector3(lua_State* L, int idx) {
+        return Vector3(static_cast<float>(luaL_checknumber(L, idx)),
+                       static_cast<float>(luaL_checknumber(L, idx + 1)),
+                       static_cast<float>(luaL_checknumber(L, idx + 2)));
+    }
+
+    static void pushVector3(lua_State* L, const Vector3& v) {
+        lua_newtable(L);
+        lua_pushnumber(L, v.x); lua_setfield(L, -2, "x");
+        lua_pushnumber(L, v.y); lua_setfield(L, -2, "y");
+        lua_pushnumber(L, v.z); lua_setfield(L, -2, "z");
+    }
+
+    static void pushRaycastHit(lua_State* L, const RaycastHit& hit) {
+        lua_newtable(L);
+        pushEntity(L, hit.entity); lua_setfield(L, -2, "entity");
+        lua_pushnumber(L, hit.distance); lua_setfield(L, -2, "distance");
+        pushVector3(L, hit.point); lua_setfield(L, -2, "point");
+        pushVector3(L, hit.normal); lua_setfield(L, -2, "normal");
+        lua_pushinteger(L, hit.triangle); lua_setfield(L, -2, "triangle");
+    }
+
     static int l_getScene(lua_State* L) {
         Scene** s = (Scene**)lua_newuserdata(L, sizeof(Scene*));
         *s = g_engine->getScene();
@@ -80,17 +135,13 @@ private:
 
     static int l_createMesh(lua_State* L) {
         const char* name = luaL_optstring(L, 1, "Mesh");
-        std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)lua_newuserdata(L, sizeof(std::shared_ptr<Mesh>));
-        new (m) std::shared_ptr<Mesh>(std::make_shared<Mesh>(name));
-        luaL_setmetatable(L, "Mesh");
+        pushEntity(L, g_engine->getScene()->spawn(std::make_shared<Mesh>(name)), true);
         return 1;
     }
 
     static int l_createCube(lua_State* L) {
         const char* name = luaL_optstring(L, 1, "Cube");
-        std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)lua_newuserdata(L, sizeof(std::shared_ptr<Mesh>));
-        new (m) std::shared_ptr<Mesh>(Mesh::createCube(name));
-        luaL_setmetatable(L, "Mesh");
+        pushEntity(L, g_engine->getScene()->spawn(Mesh::createCube(name)), true);
         return 1;
     }
 
@@ -98,9 +149,7 @@ private:
         const char* name = luaL_optstring(L, 1, "Plane");
         float width = luaL_optnumber(L, 2, 1.0f);
         float height = luaL_optnumber(L, 3, 1.0f);
-        std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)lua_newuserdata(L, sizeof(std::shared_ptr<Mesh>));
-        new (m) std::shared_ptr<Mesh>(Mesh::createPlane(name, width, height));
-        luaL_setmetatable(L, "Mesh");
+        pushEntity(L, g_engine->getScene()->spawn(Mesh::createPlane(name, width, height)), true);
         return 1;
     }
 
@@ -108,9 +157,7 @@ private:
         const char* name = luaL_optstring(L, 1, "Sphere");
         int segments = luaL_optinteger(L, 2, 16);
         int rings = luaL_optinteger(L, 3, 16);
-        std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)lua_newuserdata(L, sizeof(std::shared_ptr<Mesh>));
-        new (m) std::shared_ptr<Mesh>(Mesh::createSphere(name, segments, rings));
-        luaL_setmetatable(L, "Mesh");
+        pushEntity(L, g_engine->getScene()->spawn(Mesh::createSphere(name, segments, rings)), true);
         return 1;
     }
 
@@ -122,8 +169,8 @@ private:
     }
 
     static int l_addEntity(lua_State* L) {
-        std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)luaL_checkudata(L, 1, "Mesh");
-        g_engine->getScene()->addEntity(*m);
+        EntityId* id = checkEntity(L, 1);
+        g_engine->getScene()->addEntity(*id);
         return 0;
     }
 
@@ -202,6 +249,30 @@ private:
         return 1;
     }
 
+    static int l_visibleCount(lua_State* L) {
+        lua_pushinteger(L, static_cast<lua_Integer>(g_engine->getCullingStats().visible));
+        return 1;
+    }
+
+    static int l_culledCount(lua_State* L) {
+        lua_pushinteger(L, static_cast<lua_Integer>(g_engine->getCullingStats().culled));
+        return 1;
+    }
+
+    // pick([x, y]) -> hit table or nil; defaults to the mouse position.
+    static int l_pick(lua_State* L) {
+        Vector2 mouse = Input::instance().getMousePosition();
+        float x = static_cast<float>(luaL_optnumber(L, 1, mouse.x));
+        float y = static_cast<float>(luaL_optnumber(L, 2, mouse.y));
+        RaycastHit hit;
+        if (!g_engine->pick(x, y, hit)) {
+            lua_pushnil(L);
+            return 1;
+        }
+        pushRaycastHit(L, hit);
+        return 1;
+    }
+
     static int l_quit(lua_State* L) {
         (void)L;
         g_engine->stop();
@@ -333,94 +404,149 @@ private:
         return 0;
     }
 
-    static int l_mesh_gc(lua_State* L) {
-        std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)luaL_checkudata(L, 1, "Mesh");
-        m->~shared_ptr();
-        return 0;
-    }
-
     static int l_mesh_index(lua_State* L) {
-        std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)luaL_checkudata(L, 1, "Mesh");
+        EntityId* id = checkEntity(L, 1);
         const char* key = luaL_checkstring(L, 2);
 
+        if (strcmp(key, "valid") == 0) {
+            lua_pushboolean(L, g_engine->getScene()->isValid(*id));
+            return 1;
+        }
+
+        Mesh* m = checkMesh(L, 1);
         if (strcmp(key, "transform") == 0) {
-            Transform* t = &(*m)->transform;
+            Transform* t = &m->transform;
             Transform** tp = (Transform**)lua_newuserdata(L, sizeof(Transform*));
             *tp = t;
             luaL_setmetatable(L, "Transform");
             return 1;
         } else if (strcmp(key, "color") == 0) {
-            Color* c = &(*m)->color;
+            Color* c = &m->color;
             Color** cp = (Color**)lua_newuserdata(L, sizeof(Color*));
             *cp = c;
             luaL_setmetatable(L, "Color");
             return 1;
         } else if (strcmp(key, "name") == 0) {
-            lua_pushstring(L, (*m)->name.c_str());
+            lua_pushstring(L, m->name.c_str());
+            return 1;
+        } else if (strcmp(key, "tag") == 0) {
+            lua_pushstring(L, m->tag.c_str());
             return 1;
         } else if (strcmp(key, "active") == 0) {
-            lua_pushboolean(L, (*m)->active);
+            lua_pushboolean(L, m->active);
             return 1;
         } else if (strcmp(key, "addVertex") == 0) {
             lua_pushcfunction(L, [](lua_State* L) -> int {
-                std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)luaL_checkudata(L, 1, "Mesh");
+                Mesh* m = checkMesh(L, 1);
                 float x = luaL_checknumber(L, 2);
                 float y = luaL_checknumber(L, 3);
                 float z = luaL_checknumber(L, 4);
-                (*m)->addVertex(x, y, z);
+                m->addVertex(x, y, z);
                 return 0;
             });
             return 1;
         } else if (strcmp(key, "addIndex") == 0) {
             lua_pushcfunction(L, [](lua_State* L) -> int {
-                std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)luaL_checkudata(L, 1, "Mesh");
+                Mesh* m = checkMesh(L, 1);
                 unsigned int idx = luaL_checkinteger(L, 2);
-                (*m)->addIndex(idx);
+                m->addIndex(idx);
                 return 0;
             });
             return 1;
         } else if (strcmp(key, "addTriangle") == 0) {
             lua_pushcfunction(L, [](lua_State* L) -> int {
-                std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)luaL_checkudata(L, 1, "Mesh");
+                Mesh* m = checkMesh(L, 1);
                 unsigned int i0 = luaL_checkinteger(L, 2);
                 unsigned int i1 = luaL_checkinteger(L, 3);
                 unsigned int i2 = luaL_checkinteger(L, 4);
-                (*m)->addTriangle(i0, i1, i2);
+                m->addTriangle(i0, i1, i2);
                 return 0;
             });
             return 1;
         } else if (strcmp(key, "clear") == 0) {
             lua_pushcfunction(L, [](lua_State* L) -> int {
-                std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)luaL_checkudata(L, 1, "Mesh");
-                (*m)->clear();
+                Mesh* m = checkMesh(L, 1);
+                m->clear();
                 return 0;
             });
             return 1;
+        } else if (strcmp(key, "setParent") == 0) {
+            lua_pushcfunction(L, [](lua_State* L) -> int {
+                Mesh* m = checkMesh(L, 1);
+                Entity* parent = lua_isnoneornil(L, 2) ? nullptr : checkMesh(L, 2);
+                lua_pushboolean(L, m->setParent(parent));
+                return 1;
+            });
+            return 1;
         } else if (strcmp(key, "calculateNormals") == 0) {
             lua_pushcfunction(L, [](lua_State* L) -> int {
-                std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)luaL_checkudata(L, 1, "Mesh");
-                (*m)->calculateNormals();
+                Mesh* m = checkMesh(L, 1);
+                m->calculateNormals();
                 return 0;
             });
             return 1;
+        } else if (strcmp(key, "simplify") == 0) {
+            // mesh:simplify(ratio[, maxError]) -> error reached
+            lua_pushcfunction(L, [](lua_State* L) -> int {
+                Mesh* m = checkMesh(L, 1);
+                float ratio = static_cast<float>(luaL_checknumber(L, 2));
+                float maxError = static_cast<float>(luaL_optnumber(L, 3, std::numeric_limits<float>::infinity()));
+                float error = 0.0f;
+                m->setGeometry(MeshSimplifier::simplify(*m, ratio, maxError, &error));
+                lua_pushnumber(L, error);
+                return 1;
+            });
+            return 1;
+        } else if (strcmp(key, "optimize") == 0) {
+            // mesh:optimize([cacheSize]) -> ACMR before, ACMR after
+            lua_pushcfunction(L, [](lua_State* L) -> int {
+                Mesh* m = checkMesh(L, 1);
+                unsigned int cacheSize = static_cast<unsigned int>(luaL_optinteger(L, 2, MeshOptimizer::DefaultCacheSize));
+                MeshOptimizationStats stats = MeshOptimizer::optimize(*m, cacheSize);
+                lua_pushnumber(L, stats.acmrBefore);
+                lua_pushnumber(L, stats.acmrAfter);
+                return 2;
+            });
+            return 1;
+        } else if (strcmp(key, "generateLODs") == 0) {
+            // mesh:generateLODs([levels[, ratio]]) -> number of levels
+            lua_pushcfunction(L, [](lua_State* L) -> int {
+                Mesh* m = checkMesh(L, 1);
+                int levels = static_cast<int>(luaL_optinteger(L, 2, 4));
+                float ratio = static_cast<float>(luaL_optnumber(L, 3, 0.5));
+                m->lod = MeshSimplifier::generateLODs(m->geometry(), levels, ratio);
+                lua_pushinteger(L, static_cast<lua_Integer>(m->lod->levels.size()));
+                return 1;
+            });
+            return 1;
         }
 
         return 0;
     }
 
     static int l_mesh_newindex(lua_State* L) {
-        std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)luaL_checkudata(L, 1, "Mesh");
+        Mesh* m = checkMesh(L, 1);
         const char* key = luaL_checkstring(L, 2);
 
         if (strcmp(key, "name") == 0) {
-            (*m)->name = luaL_checkstring(L, 3);
+            m->setName(luaL_checkstring(L, 3));
+        } else if (strcmp(key, "tag") == 0) {
+            m->setTag(luaL_checkstring(L, 3));
         } else if (strcmp(key, "active") == 0) {
-            (*m)->active = lua_toboolean(L, 3);
+            m->active = lua_toboolean(L, 3);
         }
 
         return 0;
     }
 
+    static int l_mesh_gc(lua_State* L) {
+        EntityHandle* handle = (EntityHandle*)luaL_checkudata(L, 1, "Mesh");
+        if (handle->owner && g_engine && g_engine->getScene()) {
+            g_engine->getScene()->releaseSpawned(handle->id);
+        }
+        return 0;
+    }
+
     static int l_transform_index(lua_State* L) {
         Transform** t = (Transform**)luaL_checkudata(L, 1, "Transform");
         const char* key = luaL_checkstring(L, 2);
@@ -640,6 +766,103 @@ private:
                 return 0;
             });
             return 1;
+        } else if (strcmp(key, "entities") == 0) {
+            lua_createtable(L, static_cast<int>((*s)->entities.size()), 0);
+            int i = 1;
+            for (auto& entity : (*s)->entities) {
+                pushEntity(L, entity->id);
+                lua_rawseti(L, -2, i++);
+            }
+            return 1;
+        } else if (strcmp(key, "getEntityByName") == 0) {
+            lua_pushcfunction(L, [](lua_State* L) -> int {
+                Scene** s = (Scene**)luaL_checkudata(L, 1, "Scene");
+                EntityId id = (*s)->getEntityByName(luaL_checkstring(L, 2));
+                if (id.isValid()) pushEntity(L, id);
+                else lua_pushnil(L);
+                return 1;
+            });
+            return 1;
+        } else if (strcmp(key, "getEntitiesByTag") == 0) {
+            lua_pushcfunction(L, [](lua_State* L) -> int {
+                Scene** s = (Scene**)luaL_checkudata(L, 1, "Scene");
+                std::vector<EntityId> ids = (*s)->getEntitiesByTag(luaL_checkstring(L, 2));
+                lua_createtable(L, static_cast<int>(ids.size()), 0);
+                for (size_t i = 0; i < ids.size(); i++) {
+                    pushEntity(L, ids[i]);
+                    lua_rawseti(L, -2, static_cast<int>(i + 1));
+                }
+                return 1;
+            });
+            return 1;
+        } else if (strcmp(key, "query") == 0) {
+            lua_pushcfunction(L, [](lua_State* L) -> int {
+                Scene** s = (Scene**)luaL_checkudata(L, 1, "Scene");
+                std::vector<std::string> names;
+                for (int i = 2; i <= lua_gettop(L); i++) {
+                    names.push_back(luaL_checkstring(L, i));
+                }
+                std::vector<EntityId> ids = (*s)->query(names);
+                lua_createtable(L, static_cast<int>(ids.size()), 0);
+                for (size_t i = 0; i < ids.size(); i++) {
+                    pushEntity(L, ids[i]);
+                    lua_rawseti(L, -2, static_cast<int>(i + 1));
+                }
+                return 1;
+            });
+            return 1;
+        } else if (strcmp(key, "removeEntity") == 0) {
+            lua_pushcfunction(L, [](lua_State* L) -> int {
+                Scene** s = (Scene**)luaL_checkudata(L, 1, "Scene");
+                EntityId* id = checkEntity(L, 2);
+                (*s)->removeEntity(*id);
+                return 0;
+            });
+            return 1;
+        } else if (strcmp(key, "removeEntityByName") == 0) {
+            lua_pushcfunction(L, [](lua_State* L) -> int {
+                Scene** s = (Scene**)luaL_checkudata(L, 1, "Scene");
+                (*s)->removeEntityByName(luaL_checkstring(L, 2));
+                return 0;
+            });
+            return 1;
+        } else if (strcmp(key, "queryBox") == 0) {
+            lua_pushcfunction(L, [](lua_State* L) -> int {
+                Scene** s = (Scene**)luaL_checkudata(L, 1, "Scene");
+                BoundingBox box(checkVector3(L, 2), checkVector3(L, 5));
+                pushEntities(L, (*s)->queryBox(box));
+                return 1;
+            });
+            return 1;
+        } else if (strcmp(key, "querySphere") == 0) {
+            lua_pushcfunction(L, [](lua_State* L) -> int {
+                Scene** s = (Scene**)luaL_checkudata(L, 1, "Scene");
+                pushEntities(L, (*s)->querySphere(checkVector3(L, 2), static_cast<float>(luaL_checknumber(L, 5))));
+                return 1;
+            });
+            return 1;
+        } else if (strcmp(key, "nearest") == 0) {
+            lua_pushcfunction(L, [](lua_State* L) -> int {
+                Scene** s = (Scene**)luaL_checkudata(L, 1, "Scene");
+                lua_Integer k = luaL_checkinteger(L, 5);
+                float maxDistance = static_cast<float>(luaL_optnumber(L, 6, std::numeric_limits<float>::infinity()));
+                pushEntities(L, (*s)->nearest(checkVector3(L, 2), k > 0 ? static_cast<size_t>(k) : 0, maxDistance));
+                return 1;
+            });
+            return 1;
+        } else if (strcmp(key, "raycast") == 0) {
+            lua_pushcfunction(L, [](lua_State* L) -> int {
+                Scene** s = (Scene**)luaL_checkudata(L, 1, "Scene");
+                float maxDistance = static_cast<float>(luaL_optnumber(L, 8, std::numeric_limits<float>::infinity()));
+                RaycastHit hit;
+                if (!(*s)->raycast(checkVector3(L, 2), checkVector3(L, 5), hit, maxDistance)) {
+                    lua_pushnil(L);
+                    return 1;
+                }
+                pushRaycastHit(L, hit);
+                return 1;
+            });
+            return 1;
         }
 
         return 0;
@@ -826,6 +1049,9 @@ public:
         lua_register(L, "deltaTime", l_deltaTime);
         lua_register(L, "totalTime", l_totalTime);
         lua_register(L, "fps", l_fps);
+        lua_register(L, "visibleCount", l_visibleCount);
+        lua_register(L, "culledCount", l_culledCount);
+        lua_register(L, "pick", l_pick);
         lua_register(L, "quit", l_quit);
         lua_register(L, "setWireframe", l_setWireframe);
         lua_register(L, "setVSync", l_setVSync);
@@ -18,6 +18,7 @@
 #define SQUIRREL_ENGINE_H
 #include "../CombineEngine.h"
 #include "../MapLoader.h"
+#include "../MeshSimplifier.h"
 #include <squirrel.h>
 #include <sqstdio.h>
 #include <sqstdaux.h>
@@ -100,10 +101,7 @@ private:
         if (sq_gettop(v) >= 2) {
             sq_getstring(v, 2, &name);
         }
-        std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)sq_newuserdata(v, sizeof(std::shared_ptr<Mesh>));
-        new (m) std::shared_ptr<Mesh>(std::make_shared<Mesh>(name));
-        sq_settypetag(v, -1, (SQUserPointer)"Mesh");
-        sq_setreleasehook(v, -1, meshReleaseHook);
+        pushEntity(v, g_engine->getScene()->spawn(std::make_shared<Mesh>(name)), true);
         return 1;
     }
 
@@ -112,10 +110,7 @@ private:
         if (sq_gettop(v) >= 2) {
             sq_getstring(v, 2, &name);
         }
-        std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)sq_newuserdata(v, sizeof(std::shared_ptr<Mesh>));
-        new (m) std::shared_ptr<Mesh>(Mesh::createCube(name));
-        sq_settypetag(v, -1, (SQUserPointer)"Mesh");
-        sq_setreleasehook(v, -1, meshReleaseHook);
+        pushEntity(v, g_engine->getScene()->spawn(Mesh::createCube(name)), true);
         return 1;
     }
 
@@ -125,10 +120,7 @@ private:
         if (sq_gettop(v) >= 2) sq_getstring(v, 2, &name);
         if (sq_gettop(v) >= 3) sq_getfloat(v, 3, &width);
         if (sq_gettop(v) >= 4) sq_getfloat(v, 4, &height);
-        std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)sq_newuserdata(v, sizeof(std::shared_ptr<Mesh>));
-        new (m) std::shared_ptr<Mesh>(Mesh::createPlane(name, width, height));
-        sq_settypetag(v, -1, (SQUserPointer)"Mesh");
-        sq_setreleasehook(v, -1, meshReleaseHook);
+        pushEntity(v, g_engine->getScene()->spawn(Mesh::createPlane(name, width, height)), true);
         return 1;
     }
 
@@ -138,10 +130,7 @@ private:
         if (sq_gettop(v) >= 2) sq_getstring(v, 2, &name);
         if (sq_gettop(v) >= 3) sq_getinteger(v, 3, &segments);
         if (sq_gettop(v) >= 4) sq_getinteger(v, 4, &rings);
-        std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)sq_newuserdata(v, sizeof(std::shared_ptr<Mesh>));
-        new (m) std::shared_ptr<Mesh>(Mesh::createSphere(name, segments, rings));
-        sq_settypetag(v, -1, (SQUserPointer)"Mesh");
-        sq_setreleasehook(v, -1, meshReleaseHook);
+        pushEntity(v, g_engine->getScene()->spawn(Mesh::createSphere(name, segments, rings)), true);
         return 1;
     }
 
@@ -156,20 +145,219 @@ private:
         SQUserPointer tag;
         sq_gettypetag(v, 2, &tag);
         if (tag == (SQUserPointer)"Mesh") {
-            std::shared_ptr<Mesh>* m;
-            sq_getuserdata(v, 2, (SQUserPointer*)&m, nullptr);
-            g_engine->getScene()->addEntity(*m);
+            EntityId* id;
+            sq_getuserdata(v, 2, (SQUserPointer*)&id, nullptr);
+            g_engine->getScene()->addEntity(*id);
         }
         return 0;
     }
 
-    static SQInteger meshReleaseHook(SQUserPointer p, SQInteger size) {
-        (void)size;
-        std::shared_ptr<Mesh>* m = (std::shared_ptr<Mesh>*)p;
-        m->~shared_ptr();
+    static SQInteger sq_removeEntity(HSQUIRRELVM v) {
+        SQUserPointer tag;
+        sq_gettypetag(v, 2, &tag);
+        if (tag == (SQUserPointer)"Mesh") {
+            EntityId* id;
+            sq_getuserdata(v, 2, (SQUserPointer*)&id, nullptr);
+            g_engine->getScene()->removeEntity(*id);
+        }
         return 0;
     }
 
+    static SQInteger sq_setParent(HSQUIRRELVM v) {
+        Mesh* child = nullptr;
+        Mesh* parent = nullptr;
+        if (SQ_FAILED(getMesh(v, 2, child))) return SQ_ERROR;
+        if (sq_gettype(v, 3) != OT_NULL && SQ_FAILED(getMesh(v, 3, parent))) return SQ_ERROR;
+        sq_pushbool(v, child && child->setParent(parent));
+        return 1;
+    }
+
+    static SQInteger sq_query(HSQUIRRELVM v) {
+        std::vector<std::string> names;
+        for (SQInteger i = 2; i <= sq_gettop(v); i++) {
+            const SQChar* name;
+            if (SQ_FAILED(sq_getstring(v, i, &name))) return sq_throwerror(v, "query expects component names");
+            names.push_back(name);
+        }
+        std::vector<EntityId> ids = g_engine->getScene()->query(names);
+        sq_newarray(v, 0);
+        for (EntityId id : ids) {
+            pushEntity(v, id);
+            sq_arrayappend(v, -2);
+        }
+        return 1;
+    }
+
+    // The handle a create* function returns owns its entity until it is
+    // added, so a mesh the script drops first is freed when it is released.
+    static void pushEntity(HSQUIRRELVM v, EntityId id, bool owner = false) {
+        EntityId* handle = (EntityId*)sq_newuserdata(v, sizeof(EntityId));
+        new (handle) EntityId(id);
+        sq_settypetag(v, -1, (SQUserPointer)"Mesh");
+        if (owner) sq_setreleasehook(v, -1, releaseSpawned);
+    }
+
+    static SQInteger releaseSpawned(SQUserPointer p, SQInteger) {
+        if (g_engine && g_engine->getScene()) {
+            g_engine->getScene()->releaseSpawned(*(EntityId*)p);
+        }
+        return 1;
+    }
+
+    static void pushEntities(HSQUIRRELVM v, const std::vector<EntityId>& ids) {
+        sq_newarray(v, 0);
+        for (EntityId id : ids) {
+            pushEntity(v, id);
+            sq_arrayappend(v, -2);
+        }
+    }
+
+    static Vector3 getVector3(HSQUIRRELVM v, SQInteger idx) {
+        SQFloat x = 0, y = 0, z = 0;
+        sq_getfloat(v, idx, &x);
+        sq_getfloat(v, idx + 1, &y);
+        sq_getfloat(v, idx + 2, &z);
+        return Vector3(x, y, z);
+    }
+
+    static void pushVector3(HSQUIRRELVM v, const Vector3& value) {
+        sq_newtable(v);
+        sq_pushstring(v, "x", -1);
+        sq_pushfloat(v, value.x);
+        sq_newslot(v, -3, SQFalse);
+        sq_pushstring(v, "y", -1);
+        sq_pushfloat(v, value.y);
+        sq_newslot(v, -3, SQFalse);
+        sq_pushstring(v, "z", -1);
+        sq_pushfloat(v, value.z);
+        sq_newslot(v, -3, SQFalse);
+    }
+
+    static SQFloat optFloat(HSQUIRRELVM v, SQInteger idx, SQFloat fallback) {
+        SQFloat value = fallback;
+        if (sq_gettop(v) >= idx) sq_getfloat(v, idx, &value);
+        return value;
+    }
+
+    static SQInteger sq_queryBox(HSQUIRRELVM v) {
+        BoundingBox box(getVector3(v, 2), getVector3(v, 5));
+        pushEntities(v, g_engine->getScene()->queryBox(box));
+        return 1;
+    }
+
+    static SQInteger sq_querySphere(HSQUIRRELVM v) {
+        SQFloat radius = 0;
+        sq_getfloat(v, 5, &radius);
+        pushEntities(v, g_engine->getScene()->querySphere(getVector3(v, 2), radius));
+        return 1;
+    }
+
+    static SQInteger sq_nearest(HSQUIRRELVM v) {
+        SQInteger k = 0;
+        sq_getinteger(v, 5, &k);
+        SQFloat maxDistance = optFloat(v, 6, std::numeric_limits<SQFloat>::infinity());
+        pushEntities(v, g_engine->getScene()->nearest(getVector3(v, 2), k > 0 ? static_cast<size_t>(k) : 0, maxDistance));
+        return 1;
+    }
+
+    static void pushRaycastHit(HSQUIRRELVM v, const RaycastHit& hit) {
+        sq_newtable(v);
+        sq_pushstring(v, "entity", -1);
+        pushEntity(v, hit.entity);
+        sq_newslot(v, -3, SQFalse);
+        sq_pushstring(v, "distance", -1);
+        sq_pushfloat(v, hit.distance);
+        sq_newslot(v, -3, SQFalse);
+        sq_pushstring(v, "point", -1);
+        pushVector3(v, hit.point);
+        sq_newslot(v, -3, SQFalse);
+        sq_pushstring(v, "normal", -1);
+        pushVector3(v, hit.normal);
+        sq_newslot(v, -3, SQFalse);
+        sq_pushstring(v, "triangle", -1);
+        sq_pushinteger(v, hit.triangle);
+        sq_newslot(v, -3, SQFalse);
+    }
+
+    static SQInteger sq_raycast(HSQUIRRELVM v) {
+        RaycastHit hit;
+        SQFloat maxDistance = optFloat(v, 8, std::numeric_limits<SQFloat>::infinity());
+        if (!g_engine->getScene()->raycast(getVector3(v, 2), getVector3(v, 5), hit, maxDistance)) {
+            sq_pushnull(v);
+            return 1;
+        }
+        pushRaycastHit(v, hit);
+        return 1;
+    }
+
+    // pick([x, y]) -> hit table or null; defaults to the mouse position.
+    static SQInteger sq_pick(HSQUIRRELVM v) {
+        Vector2 mouse = Input::instance().getMousePosition();
+        RaycastHit hit;
+        if (!g_engine->pick(optFloat(v, 2, mouse.x), optFloat(v, 3, mouse.y), hit)) {
+            sq_pushnull(v);
+            return 1;
+        }
+        pushRaycastHit(v, hit);
+        return 1;
+    }
+
+    // simplifyMesh(mesh[, ratio[, maxError]]) -> error reached
+    static SQInteger sq_simplifyMesh(HSQUIRRELVM v) {
+        Mesh* m = nullptr;
+        if (SQ_FAILED(getMesh(v, 2, m))) return SQ_ERROR;
+        if (!m) return 0;
+        SQFloat ratio = optFloat(v, 3, 0.5f);
+        SQFloat maxError = optFloat(v, 4, std::numeric_limits<SQFloat>::infinity());
+        float error = 0.0f;
+        m->setGeometry(MeshSimplifier::simplify(*m, ratio, maxError, &error));
+        sq_pushfloat(v, error);
+        return 1;
+    }
+
+    // optimizeMesh(mesh[, cacheSize]) -> {acmrBefore, acmrAfter}
+    static SQInteger sq_optimizeMesh(HSQUIRRELVM v) {
+        Mesh* m = nullptr;
+        if (SQ_FAILED(getMesh(v, 2, m))) return SQ_ERROR;
+        if (!m) return 0;
+        SQInteger cacheSize = MeshOptimizer::DefaultCacheSize;
+        if (sq_gettop(v) >= 3) sq_getinteger(v, 3, &cacheSize);
+        MeshOptimizationStats stats = MeshOptimizer::optimize(*m, static_cast<unsigned int>(cacheSize));
+        sq_newtable(v);
+        sq_pushstring(v, "acmrBefore", -1);
+        sq_pushfloat(v, stats.acmrBefore);
+        sq_newslot(v, -3, SQFalse);
+        sq_pushstring(v, "acmrAfter", -1);
+        sq_pushfloat(v, stats.acmrAfter);
+        sq_newslot(v, -3, SQFalse);
+        return 1;
+    }
+
+    // generateLODs(mesh[, levels[, ratio]]) -> number of levels
+    static SQInteger sq_generateLODs(HSQUIRRELVM v) {
+        Mesh* m = nullptr;
+        if (SQ_FAILED(getMesh(v, 2, m))) return SQ_ERROR;
+        if (!m) return 0;
+        SQInteger levels = 4;
+        if (sq_gettop(v) >= 3) sq_getinteger(v, 3, &levels);
+        m->lod = MeshSimplifier::generateLODs(m->geometry(), static_cast<int>(levels), optFloat(v, 4, 0.5f));
+        sq_pushinteger(v, static_cast<SQInteger>(m->lod->levels.size()));
+        return 1;
+    }
+
+    // Raises a script error unless argument idx is a mesh handle. A handle
+    // to a mesh that no longer exists gives nullptr.
+    static SQRESULT getMesh(HSQUIRRELVM v, SQInteger idx, Mesh*& mesh) {
+        SQUserPointer tag = nullptr;
+        EntityId* id = nullptr;
+        if (SQ_FAILED(sq_gettypetag(v, idx, &tag)) || tag != (SQUserPointer)"Mesh" ||
+            SQ_FAILED(sq_getuserdata(v, idx, (SQUserPointer*)&id, nullptr))) {
+            return sq_throwerror(v, "expected a Mesh");
+        }
+        mesh = g_engine->getScene()->getEntity<Mesh>(*id);
+        return SQ_OK;
+    }
+
     static SQInteger sq_isKeyDown(HSQUIRRELVM v) {
         SQInteger key;
         sq_getinteger(v, 2, &key);
@@ -256,6 +444,16 @@ private:
         return 1;
     }
 
+    static SQInteger sq_visibleCount(HSQUIRRELVM v) {
+        sq_pushinteger(v, static_cast<SQInteger>(g_engine->getCullingStats().visible));
+        return 1;
+    }
+
+    static SQInteger sq_culledCount(HSQUIRRELVM v) {
+        sq_pushinteger(v, static_cast<SQInteger>(g_engine->getCullingStats().culled));
+        return 1;
+    }
+
     static SQInteger sq_quit(HSQUIRRELVM v) {
         (void)v;
         g_engine->stop();
@@ -403,26 +601,38 @@ private:
     }
 
     static SQInteger sq_mesh_get(HSQUIRRELVM v) {
-        std::shared_ptr<Mesh>* m;
-        sq_getuserdata(v, 1, (SQUserPointer*)&m, nullptr);
+        Mesh* m = nullptr;
+        if (SQ_FAILED(getMesh(v, 1, m))) return SQ_ERROR;
         const SQChar* key;
         sq_getstring(v, 2, &key);
 
+        if (strcmp(key, "valid") == 0) {
+            sq_pushbool(v, m != nullptr);
+            return 1;
+        }
+        if (!m) {
+            sq_pushnull(v);
+            return 1;
+        }
+
         if (strcmp(key, "transform") == 0) {
             Transform** t = (Transform**)sq_newuserdata(v, sizeof(Transform*));
-            *t = &(*m)->transform;
+            *t = &m->transform;
             sq_settypetag(v, -1, (SQUserPointer)"Transform");
             return 1;
         } else if (strcmp(key, "color") == 0) {
             Color** c = (Color**)sq_newuserdata(v, sizeof(Color*));
-            *c = &(*m)->color;
+            *c = &m->color;
             sq_settypetag(v, -1, (SQUserPointer)"Color");
             return 1;
         } else if (strcmp(key, "name") == 0) {
-            sq_pushstring(v, (*m)->name.c_str(), -1);
+            sq_pushstring(v, m->name.c_str(), -1);
+            return 1;
+        } else if (strcmp(key, "tag") == 0) {
+            sq_pushstring(v, m->tag.c_str(), -1);
             return 1;
         } else if (strcmp(key, "active") == 0) {
-            sq_pushbool(v, (*m)->active);
+            sq_pushbool(v, m->active);
             return 1;
         }
 
@@ -431,19 +641,24 @@ private:
     }
 
     static SQInteger sq_mesh_set(HSQUIRRELVM v) {
-        std::shared_ptr<Mesh>* m;
-        sq_getuserdata(v, 1, (SQUserPointer*)&m, nullptr);
+        Mesh* m = nullptr;
+        if (SQ_FAILED(getMesh(v, 1, m))) return SQ_ERROR;
+        if (!m) return 0;
         const SQChar* key;
         sq_getstring(v, 2, &key);
 
         if (strcmp(key, "name") == 0) {
             const SQChar* val;
             sq_getstring(v, 3, &val);
-            (*m)->name = val;
+            m->setName(val);
+        } else if (strcmp(key, "tag") == 0) {
+            const SQChar* val;
+            sq_getstring(v, 3, &val);
+            m->setTag(val);
         } else if (strcmp(key, "active") == 0) {
             SQBool val;
             sq_getbool(v, 3, &val);
-            (*m)->active = val;
+            m->active = val;
         }
 
         return 0;
@@ -844,6 +1059,17 @@ public:
         registerFunction("createSphere", sq_createSphere);
         registerFunction("createLight", sq_createLight);
         registerFunction("addEntity", sq_addEntity);
+        registerFunction("removeEntity", sq_removeEntity);
+        registerFunction("query", sq_query);
+        registerFunction("queryBox", sq_queryBox);
+        registerFunction("querySphere", sq_querySphere);
+        registerFunction("nearest", sq_nearest);
+        registerFunction("raycast", sq_raycast);
+        registerFunction("pick", sq_pick);
+        registerFunction("simplifyMesh", sq_simplifyMesh);
+        registerFunction("optimizeMesh", sq_optimizeMesh);
+        registerFunction("generateLODs", sq_generateLODs);
+        registerFunction("setParent", sq_setParent);
         registerFunction("isKeyDown", sq_isKeyDown);
         registerFunction("isKeyPressed", sq_isKeyPressed);
         registerFunction("isKeyReleased", sq_isKeyReleased);
@@ -855,6 +1081,8 @@ public:
         registerFunction("deltaTime", sq_deltaTime);
         registerFunction("totalTime", sq_totalTime);
         registerFunction("fps", sq_fps);
+        registerFunction("visibleCount", sq_visibleCount);
+        registerFunction("culledCount", sq_culledCount);
         registerFunction("quit", sq_quit);
         registerFunction("setWireframe", sq_setWireframe);
         registerFunction("setVSync", sq_setVSync);
@@ -42,6 +42,7 @@ get_available_scripts() {
 load_config() {
   if [ -f "$CONFIG_FILE" ]; then
     source "$CONFIG_FILE"
+    WORKER_THREADS="${WORKER_THREADS:-0}"
   else
     local available_renderers=($(get_available_renderers))
     local available_scripts=($(get_available_scripts))
@@ -51,6 +52,7 @@ load_config() {
     DEBUG="yes"
     OPTIMIZATIONS="yes"
     STATIC="no"
+    WORKER_THREADS="0"
     WINDOW_TITLE="Combine Engine"
   fi
 }
@@ -63,6 +65,7 @@ INIT_SCRIPT=$INIT_SCRIPT
 DEBUG=$DEBUG
 OPTIMIZATIONS=$OPTIMIZATIONS
 STATIC=$STATIC
+WORKER_THREADS=$WORKER_THREADS
 WINDOW_TITLE=$WINDOW_TITLE
 EOF
   echo "-> $CONFIG_FILE"
@@ -136,6 +139,16 @@ set_window_title() {
   fi
 }
 
+set_worker_threads() {
+  result=$(dialog --title "Worker Threads" \
+    --inputbox "Number of job worker threads (0 = one per extra core):" 8 60 "$WORKER_THREADS" \
+    2>&1 >/dev/tty)
+
+  if [ $? -eq 0 ] && [[ "$result" =~ ^[0-9]+$ ]]; then
+    WORKER_THREADS="$result"
+  fi
+}
+
 toggle_debug() {
   if [ "$DEBUG" = "yes" ]; then
     DEBUG="no"
@@ -170,7 +183,7 @@ main_menu() {
     [ "$OPTIMIZATIONS" = "yes" ] && opt_label="[*]"
     [ "$STATIC" = "yes" ] && static_label="[*]"
     choice=$(dialog --title "Combine Engine Configuration" \
-      --menu "Use arrow keys to navigate, Enter to select:" 22 60 10 \
+      --menu "Use arrow keys to navigate, Enter to select:" 23 60 11 \
       "1" "Renderer:          $RENDERER" \
       "2" "Script Engines:    $SUPPORTED_SCRIPTS" \
       "3" "Init Script:       $INIT_SCRIPT" \
@@ -178,6 +191,7 @@ main_menu() {
       "5" "$debug_label Debug Mode" \
       "6" "$opt_label Optimizations" \
       "7" "$static_label Static Linking" \
+      "8" "Worker Threads:    $WORKER_THREADS" \
       "" "" \
       "S" "Save and Exit" \
       "Q" "Quit without Saving" \
@@ -193,6 +207,7 @@ main_menu() {
     5) toggle_debug ;;
     6) toggle_optimizations ;;
     7) toggle_static ;;
+    8) set_worker_threads ;;
     S)
       save_config
       break
@@ -7,13 +7,11 @@ in vec4 VertexColor;
 out vec4 FragColor;
 
 uniform vec3 viewPos;
-uniform vec4 ambientColor;
 uniform vec4 meshColor;
 uniform bool uHasTexture;
 uniform sampler2D uTextureSampler;
 uniform float time;
 
-#define MAX_LIGHTS 8
 struct Light {
     int type;
     vec3 position;
@@ -21,56 +19,79 @@ struct Light {
     vec4 color;
     float intensity;
     float range;
-    float spotAngle;
-    float constant;
-    float linear;
-    float quadratic;
+    float spotCos;
 };
-uniform Light lights[MAX_LIGHTS];
-uniform int numLights;
+
+layout (std140) uniform Lights {
+    vec4 ambientColor;
+    ivec4 clusterGrid;
+    ivec4 lightCounts;
+    vec4 clusterDepth;
+    vec4 screenSize;
+};
+uniform samplerBuffer uLightData;
+uniform usamplerBuffer uLightGrid;
+uniform usamplerBuffer uLightIndices;
+
+Light fetchLight(int index) {
+    int base = int(texelFetch(uLightIndices, index).r) * 4;
+    vec4 a = texelFetch(uLightData, base);
+    vec4 b = texelFetch(uLightData, base + 1);
+    vec4 c = texelFetch(uLightData, base + 2);
+    vec4 d = texelFetch(uLightData, base + 3);
+    return Light(int(a.w), a.xyz, b.xyz, c, d.x, b.w, d.y);
+}
+
+// Global (directional) lights live at [0, lightCounts.y) of uLightIndices;
+// the rest are the lights whose range reaches this fragment's cluster.
+uvec2 clusterLights() {
+    float ndcDepth = gl_FragCoord.z * 2.0 - 1.0;
+    float zNear = clusterDepth.x;
+    float zFar = clusterDepth.y;
+    float depth = 2.0 * zNear * zFar / (zFar + zNear - ndcDepth * (zFar - zNear));
+    int slice = clamp(int(log(depth / zNear) * clusterDepth.z), 0, clusterGrid.z - 1);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / screenSize.xy * vec2(clusterGrid.xy)), ivec2(0), clusterGrid.xy - 1);
+    return texelFetch(uLightGrid, (slice * clusterGrid.y + tile.y) * clusterGrid.x + tile.x).rg;
+}
+
+vec3 shade(Light light, vec3 norm, vec3 viewDir) {
+    vec3 lightDir;
+    float attenuation = 1.0;
+    if (light.type == 0) {
+        lightDir = normalize(-light.direction);
+    } else {
+        vec3 toLight = light.position - FragPos;
+        float dist = length(toLight);
+        lightDir = normalize(toLight);
+        attenuation = clamp(1.0 - dist / light.range, 0.0, 1.0);
+        attenuation *= attenuation;
+        if (light.type == 2) {
+            float theta = dot(lightDir, -light.direction);
+            attenuation *= theta > light.spotCos ? (theta - light.spotCos) / (1.0 - light.spotCos) : 0.0;
+        }
+    }
+
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = diff * light.color.rgb * light.intensity;
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(norm, halfwayDir), 0.0), 64.0);
+    vec3 specular = spec * light.color.rgb * light.intensity * 0.5;
+    return (diffuse + specular) * attenuation;
+}
 
 void main() {
     vec3 norm = normalize(Normal);
     vec3 viewDir = normalize(viewPos - FragPos);
-    vec3 ambient = ambientColor.rgb * ambientColor.a;
-    vec3 result = ambient;
-    
-    for (int i = 0; i < numLights && i < MAX_LIGHTS; i++) {
-        vec3 lightDir;
-        float attenuation = 1.0;
-        if (lights[i].type == 0) {
-            lightDir = normalize(-lights[i].direction);
-        } else if (lights[i].type == 1) {
-            vec3 toLight = lights[i].position - FragPos;
-            float dist = length(toLight);
-            lightDir = normalize(toLight);
-            attenuation = clamp(1.0 - dist / lights[i].range, 0.0, 1.0);
-            attenuation *= attenuation;
-        } else {
-            vec3 toLight = lights[i].position - FragPos;
-            float dist = length(toLight);
-            lightDir = normalize(toLight);
-            float theta = dot(lightDir, normalize(-lights[i].direction));
-            float cutoff = cos(radians(lights[i].spotAngle));
-            if (theta > cutoff) {
-                attenuation = clamp(1.0 - dist / lights[i].range, 0.0, 1.0);
-                attenuation *= attenuation;
-                attenuation *= (theta - cutoff) / (1.0 - cutoff);
-            } else {
-                attenuation = 0.0;
-            }
-        }
-
-        float diff = max(dot(norm, lightDir), 0.0);
-        vec3 diffuse = diff * lights[i].color.rgb * lights[i].intensity;
-        
-        vec3 halfwayDir = normalize(lightDir + viewDir);
-        float spec = pow(max(dot(norm, halfwayDir), 0.0), 64.0);
-        vec3 specular = spec * lights[i].color.rgb * lights[i].intensity * 0.5;
-        result += (diffuse + specular) * attenuation;
+    vec3 result = ambientColor.rgb * ambientColor.a;
+    for (int i = 0; i < lightCounts.y; i++) {
+        result += shade(fetchLight(i), norm, viewDir);
+    }
+    uvec2 cluster = clusterLights();
+    for (uint i = 0u; i < cluster.y; i++) {
+        result += shade(fetchLight(int(cluster.x + i)), norm, viewDir);
     }
 
-    if (numLights == 0) {
+    if (lightCounts.x == 0) {
         result = vec3(1.0);
     }
 
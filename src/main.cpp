@@ -44,6 +44,9 @@ int main() {
     Combine::Engine engine;
     Combine::g_engine = &engine;
     engine.setRenderer(std::make_unique<Combine::COMBINE_RENDERER_CLASS>());
+#ifdef COMBINE_WORKER_THREADS
+    engine.setWorkerCount(COMBINE_WORKER_THREADS);
+#endif
 
 #ifdef COMBINE_SCRIPT_CHAISCRIPT
     engine.addScriptEngine(std::make_unique<Combine::ChaiScriptEngine>());